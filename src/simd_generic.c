@@ -0,0 +1,574 @@
+#include <stdint.h>
+#include <string.h>
+
+
+// The same kernels as simd_sse2.c, for every other architecture. Where the
+// compiler and the target have 128 bit vectors, they're written with the
+// GCC/Clang vector extensions. Everywhere else, and with TCOMB_SWAR, each
+// uint64_t holds eight pixels and the byte arithmetic is done with masks
+// so that no carry or borrow crosses from one pixel into the next.
+//
+// Both produce exactly what the C versions in tcomb_core.c produce. Like
+// the SSE2 kernels, they process whole blocks and may write up to 15
+// bytes past the width, which the strides leave room for.
+
+#if !defined(TCOMB_SWAR) && defined(__GNUC__) && \
+    (defined(__ALTIVEC__) || defined(__VEC__) || defined(__ARM_NEON) || defined(__ARM_NEON__) || \
+     defined(__mips_msa) || defined(__loongarch_sx) || defined(__wasm_simd128__) || defined(__SSE2__))
+#define TCOMB_VECTORS
+#endif
+
+
+#ifdef TCOMB_VECTORS
+
+typedef uint8_t vec __attribute__((vector_size(16)));
+typedef uint16_t wide __attribute__((vector_size(16)));
+
+// 0xFF where a >= b.
+static inline vec geMask(vec a, vec b) {
+    return (vec)(a >= b);
+}
+
+// 0xFF where a is 0.
+static inline vec zeroMask(vec a) {
+    return (vec)(a == (vec){ 0 });
+}
+
+static inline vec addWrap(vec a, vec b) {
+    return a + b;
+}
+
+static inline vec subWrap(vec a, vec b) {
+    return a - b;
+}
+
+#else
+
+typedef uint64_t vec;
+typedef uint64_t wide;
+
+#define HIGH_BITS 0x8080808080808080ULL
+
+// Turns the top bit of each byte into 0 or 0xFF.
+static inline vec spreadHigh(vec h) {
+    return (h >> 7) * 0xFF;
+}
+
+// The top bit of (a | 0x80) - (b & 0x7F) is set where the low seven bits of
+// a are at least those of b, and the subtraction never borrows from the
+// next byte. The top bits of a and b decide the rest.
+static inline vec geMask(vec a, vec b) {
+    const vec low = (a | HIGH_BITS) - (b & ~HIGH_BITS);
+    return spreadHigh(((a & ~b) | (~(a ^ b) & low)) & HIGH_BITS);
+}
+
+static inline vec zeroMask(vec a) {
+    return spreadHigh(~(((a & ~HIGH_BITS) + ~HIGH_BITS) | a) & HIGH_BITS);
+}
+
+static inline vec addWrap(vec a, vec b) {
+    return ((a & ~HIGH_BITS) + (b & ~HIGH_BITS)) ^ ((a ^ b) & HIGH_BITS);
+}
+
+static inline vec subWrap(vec a, vec b) {
+    return ((a | HIGH_BITS) - (b & ~HIGH_BITS)) ^ ((a ^ ~b) & HIGH_BITS);
+}
+
+#endif
+
+
+static inline vec load(const uint8_t *p) {
+    vec v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline void store(uint8_t *p, vec v) {
+    memcpy(p, &v, sizeof(v));
+}
+
+static inline vec splat(int c) {
+    vec v;
+    memset(&v, c, sizeof(v));
+    return v;
+}
+
+static inline vec minU8(vec a, vec b) {
+    const vec m = geMask(a, b);
+    return (b & m) | (a & ~m);
+}
+
+static inline vec maxU8(vec a, vec b) {
+    const vec m = geMask(a, b);
+    return (a & m) | (b & ~m);
+}
+
+static inline vec subsU8(vec a, vec b) {
+    return subWrap(a, b) & geMask(a, b);
+}
+
+static inline vec addsU8(vec a, vec b) {
+    const vec s = addWrap(a, b);
+    return s | ~geMask(s, a);
+}
+
+// The larger minus the smaller never borrows, so plain subtraction works
+// for both kinds of vec.
+static inline vec absDiffU8(vec a, vec b) {
+    const vec m = geMask(a, b);
+    return ((a & m) | (b & ~m)) - ((b & m) | (a & ~m));
+}
+
+// (a + b + 1) / 2
+static inline vec avgU8(vec a, vec b) {
+    return (a | b) - (((a ^ b) >> 1) & splat(0x7F));
+}
+
+// (a + b) / 2
+static inline vec avgFloorU8(vec a, vec b) {
+    return (a & b) + (((a ^ b) >> 1) & splat(0x7F));
+}
+
+// (a + b * 2 + c + 2) / 4, which equals (b + (a + c) / 2 + 1) / 2.
+static inline vec blur121(vec a, vec b, vec c) {
+    return avgU8(b, avgFloorU8(a, c));
+}
+
+
+// Sixteen bit lanes, each holding every other pixel of a vec. Which pixels
+// end up in lo and which in hi depends on the byte order, but packWide puts
+// them back where they came from.
+static inline wide splatWide(int c) {
+    uint16_t lanes[sizeof(wide) / 2];
+    for (size_t i = 0; i < sizeof(wide) / 2; i++)
+        lanes[i] = c;
+
+    wide w;
+    memcpy(&w, lanes, sizeof(w));
+    return w;
+}
+
+static inline wide wideLo(vec v) {
+    return (wide)v & splatWide(0xFF);
+}
+
+static inline wide wideHi(vec v) {
+    return ((wide)v >> 8) & splatWide(0xFF);
+}
+
+// lo and hi must be at most 255.
+static inline vec packWide(wide lo, wide hi) {
+    return (vec)(lo | (hi << 8));
+}
+
+static inline int64_t sumWide(wide w) {
+    uint16_t lanes[sizeof(wide) / 2];
+    memcpy(lanes, &w, sizeof(w));
+
+    int64_t sum = 0;
+    for (size_t i = 0; i < sizeof(wide) / 2; i++)
+        sum += lanes[i];
+    return sum;
+}
+
+
+#define STEP ((int)sizeof(vec))
+
+
+void buildFinalMask_generic( const uint8_t *s1p, const uint8_t *s2p, const uint8_t *m1p, uint8_t *dstp, intptr_t src_stride, intptr_t dst_stride, intptr_t width, intptr_t height, intptr_t thresh) {
+    const vec th = splat(thresh - 1);
+
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x += STEP) {
+            vec m0 = absDiffU8(load(&s1p[x]), load(&s2p[x]));
+            m0 = zeroMask(subsU8(m0, th));
+            store(&dstp[x], m0 & load(&m1p[x]));
+        }
+
+        s1p += src_stride;
+        s2p += src_stride;
+        m1p += dst_stride;
+        dstp += dst_stride;
+    }
+}
+
+
+void absDiff_generic( const uint8_t *srcp1, const uint8_t *srcp2, uint8_t *dstp, intptr_t src_stride, intptr_t dst_stride, intptr_t width, intptr_t height) {
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x += STEP)
+            store(&dstp[x], absDiffU8(load(&srcp1[x]), load(&srcp2[x])));
+
+        srcp1 += src_stride;
+        srcp2 += src_stride;
+        dstp += dst_stride;
+    }
+}
+
+
+void absDiffAndMinMask_generic( const uint8_t *srcp1, const uint8_t *srcp2, uint8_t *dstp, intptr_t stride, intptr_t width, intptr_t height) {
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x += STEP) {
+            const vec m0 = absDiffU8(load(&srcp1[x]), load(&srcp2[x]));
+            store(&dstp[x], minU8(m0, load(&dstp[x])));
+        }
+
+        srcp1 += stride;
+        srcp2 += stride;
+        dstp += stride;
+    }
+}
+
+
+void absDiffAndMinMaskThresh_generic( const uint8_t *srcp1, const uint8_t *srcp2, uint8_t *dstp, intptr_t stride, intptr_t width, intptr_t height, intptr_t thresh) {
+    const vec th = splat(thresh - 1);
+
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x += STEP) {
+            vec m0 = absDiffU8(load(&srcp1[x]), load(&srcp2[x]));
+            m0 = minU8(m0, load(&dstp[x]));
+            store(&dstp[x], zeroMask(subsU8(m0, th)));
+        }
+
+        srcp1 += stride;
+        srcp2 += stride;
+        dstp += stride;
+    }
+}
+
+
+void checkOscillation5_generic( const uint8_t *p2p, const uint8_t *p1p, const uint8_t *s1p, const uint8_t *n1p, const uint8_t *n2p, uint8_t *dstp, intptr_t src_stride, intptr_t dst_stride, intptr_t width, intptr_t height, intptr_t thresh) {
+    const vec th = splat(thresh - 1);
+    const vec bytes_1 = splat(1);
+
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x += STEP) {
+            const vec p2 = load(&p2p[x]);
+            const vec s1 = load(&s1p[x]);
+            const vec n2 = load(&n2p[x]);
+            const vec p1 = load(&p1p[x]);
+            const vec n1 = load(&n1p[x]);
+
+            const vec min31 = minU8(minU8(p2, s1), n2);
+            const vec max31 = maxU8(maxU8(p2, s1), n2);
+            const vec min22 = minU8(p1, n1);
+            const vec max22 = maxU8(p1, n1);
+
+            // max31 < min22 or max31 == 0, and the other way around.
+            const vec apart = zeroMask(subsU8(max31, subsU8(min22, bytes_1))) |
+                              zeroMask(subsU8(max22, subsU8(min31, bytes_1)));
+            const vec flat = zeroMask(subsU8(subsU8(max22, min22), th)) &
+                             zeroMask(subsU8(subsU8(max31, min31), th));
+
+            store(&dstp[x], apart & flat);
+        }
+
+        p2p += src_stride;
+        p1p += src_stride;
+        s1p += src_stride;
+        n1p += src_stride;
+        n2p += src_stride;
+        dstp += dst_stride;
+    }
+}
+
+
+void calcAverages_generic( const uint8_t *s1p, const uint8_t *s2p, uint8_t *dstp, intptr_t src_stride, intptr_t dst_stride, intptr_t width, intptr_t height) {
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x += STEP)
+            store(&dstp[x], avgU8(load(&s1p[x]), load(&s2p[x])));
+
+        s1p += src_stride;
+        s2p += src_stride;
+        dstp += dst_stride;
+    }
+}
+
+
+// 0xFF where the four are within thresh - 1 of each other.
+static inline vec correlated(vec a1, vec a2, vec a3, vec a4, vec th) {
+    const vec min = minU8(minU8(a1, a2), minU8(a3, a4));
+    const vec max = maxU8(maxU8(a1, a2), maxU8(a3, a4));
+
+    return zeroMask(subsU8(max - min, th));
+}
+
+
+void checkAvgOscCorrelation_generic( const uint8_t *s1p, const uint8_t *s2p, const uint8_t *s3p, const uint8_t *s4p, uint8_t *dstp, intptr_t stride, intptr_t width, intptr_t height, intptr_t thresh) {
+    const vec th = splat(thresh - 1);
+
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x += STEP) {
+            const vec m1 = correlated(load(&s1p[x]), load(&s2p[x]), load(&s3p[x]), load(&s4p[x]), th);
+            store(&dstp[x], m1 & load(&dstp[x]));
+        }
+
+        s1p += stride;
+        s2p += stride;
+        s3p += stride;
+        s4p += stride;
+        dstp += stride;
+    }
+}
+
+
+void checkAvgOscCorrelationFields_generic( const uint8_t *c1p, const uint8_t *p1p, const uint8_t *c2p, const uint8_t *p2p, const uint8_t *c3p, const uint8_t *p3p, const uint8_t *c4p, const uint8_t *p4p, uint8_t *dstp, intptr_t src_stride, intptr_t dst_stride, intptr_t width, intptr_t height, intptr_t thresh) {
+    const vec th = splat(thresh - 1);
+
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x += STEP) {
+            const vec m1 = correlated(avgU8(load(&c1p[x]), load(&p1p[x])),
+                                      avgU8(load(&c2p[x]), load(&p2p[x])),
+                                      avgU8(load(&c3p[x]), load(&p3p[x])),
+                                      avgU8(load(&c4p[x]), load(&p4p[x])), th);
+            store(&dstp[x], m1 & load(&dstp[x]));
+        }
+
+        c1p += src_stride;
+        p1p += src_stride;
+        c2p += src_stride;
+        p2p += src_stride;
+        c3p += src_stride;
+        p3p += src_stride;
+        c4p += src_stride;
+        p4p += src_stride;
+        dstp += dst_stride;
+    }
+}
+
+
+void or3Masks_generic( const uint8_t *s1p, const uint8_t *s2p, const uint8_t *s3p, uint8_t *dstp, intptr_t stride, intptr_t width, intptr_t height) {
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x += STEP)
+            store(&dstp[x], load(&s1p[x]) | load(&s2p[x]) | load(&s3p[x]));
+
+        s1p += stride;
+        s2p += stride;
+        s3p += stride;
+        dstp += stride;
+    }
+}
+
+
+void orAndMasks_generic( const uint8_t *s1p, const uint8_t *s2p, uint8_t *dstp, intptr_t stride, intptr_t width, intptr_t height) {
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x += STEP)
+            store(&dstp[x], load(&dstp[x]) | (load(&s1p[x]) & load(&s2p[x])));
+
+        s1p += stride;
+        s2p += stride;
+        dstp += stride;
+    }
+}
+
+
+void andMasks_generic( const uint8_t *s1p, const uint8_t *s2p, uint8_t *dstp, intptr_t stride, intptr_t width, intptr_t height) {
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x += STEP)
+            store(&dstp[x], load(&s1p[x]) & load(&s2p[x]));
+
+        s1p += stride;
+        s2p += stride;
+        dstp += stride;
+    }
+}
+
+
+void or4Masks_generic( const uint8_t *s1p, const uint8_t *s2p, const uint8_t *s3p, const uint8_t *s4p, uint8_t *dstp, intptr_t stride, intptr_t width, intptr_t height) {
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x += STEP)
+            store(&dstp[x], load(&s1p[x]) | load(&s2p[x]) | load(&s3p[x]) | load(&s4p[x]));
+
+        s1p += stride;
+        s2p += stride;
+        s3p += stride;
+        s4p += stride;
+        dstp += stride;
+    }
+}
+
+
+void checkSceneChange_generic( const uint8_t *s1p, const uint8_t *s2p, intptr_t height, intptr_t width, intptr_t stride, int64_t *diffp) {
+    int64_t diff = 0;
+
+    for (int y = 0; y < height; y++) {
+        // Each lane gains at most 510 per block, so 128 blocks fit.
+        for (int x = 0; x < width; ) {
+            wide sum = splatWide(0);
+
+            for (int blocks = 0; blocks < 128 && x < width; blocks++, x += STEP) {
+                const vec d = absDiffU8(load(&s1p[x]), load(&s2p[x]));
+                sum += wideLo(d) + wideHi(d);
+            }
+
+            diff += sumWide(sum);
+        }
+
+        s1p += stride;
+        s2p += stride;
+    }
+
+    *diffp = diff;
+}
+
+
+void verticalBlur3_generic( const uint8_t *srcp, uint8_t *dstp, intptr_t src_stride, intptr_t dst_stride, intptr_t width, intptr_t height) {
+    for (int x = 0; x < width; x += STEP)
+        store(&dstp[x], avgU8(load(&srcp[x]), load(&srcp[x + src_stride])));
+
+    srcp += src_stride;
+    dstp += dst_stride;
+
+    for (int y = 0; y < height - 2; y++) {
+        for (int x = 0; x < width; x += STEP)
+            store(&dstp[x], blur121(load(&srcp[x - src_stride]), load(&srcp[x]), load(&srcp[x + src_stride])));
+
+        srcp += src_stride;
+        dstp += dst_stride;
+    }
+
+    for (int x = 0; x < width; x += STEP)
+        store(&dstp[x], avgU8(load(&srcp[x - src_stride]), load(&srcp[x])));
+}
+
+
+void andNeighborsInPlace_generic( uint8_t *srcp, intptr_t width, intptr_t height, intptr_t stride) {
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x += STEP) {
+            const vec neighbors = load(&srcp[x - stride - 1]) | load(&srcp[x - stride]) | load(&srcp[x - stride + 1]) |
+                                  load(&srcp[x + stride - 1]) | load(&srcp[x + stride]) | load(&srcp[x + stride + 1]);
+            store(&srcp[x], load(&srcp[x]) & neighbors);
+        }
+
+        srcp += stride;
+    }
+}
+
+
+void minMax_generic( const uint8_t *srcp, uint8_t *minp, uint8_t *maxp, intptr_t width, intptr_t height, intptr_t src_stride, intptr_t min_stride, intptr_t thresh) {
+    const vec th = splat(thresh);
+
+    // The rest of the 3x3 neighbourhood, after the top left pixel.
+    const intptr_t offsets[8] = {
+        -src_stride, -src_stride + 1,
+        -1, 0, 1,
+        src_stride - 1, src_stride, src_stride + 1
+    };
+
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x += STEP) {
+            vec min = load(&srcp[x - src_stride - 1]);
+            vec max = min;
+
+            for (int i = 0; i < 8; i++) {
+                const vec m2 = load(&srcp[x + offsets[i]]);
+                min = minU8(min, m2);
+                max = maxU8(max, m2);
+            }
+
+            store(&minp[x], subsU8(min, th));
+            store(&maxp[x], addsU8(max, th));
+        }
+
+        srcp += src_stride;
+        minp += min_stride;
+        maxp += min_stride;
+    }
+}
+
+
+void horizontalBlur3_generic( const uint8_t *srcp, uint8_t *dstp, intptr_t src_stride, intptr_t dst_stride, intptr_t width, intptr_t height) {
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x += STEP)
+            store(&dstp[x], blur121(load(&srcp[x - 1]), load(&srcp[x]), load(&srcp[x + 1])));
+
+        srcp += src_stride;
+        dstp += dst_stride;
+    }
+}
+
+
+// (a + b * 4 + c * 6 + d * 4 + e + 8) / 16 in one set of lanes.
+static inline wide blur14641(wide a, wide b, wide c, wide d, wide e) {
+    const wide sum = a + e + ((b + d) << 2) + (c << 2) + (c << 1) + splatWide(8);
+
+    return (sum >> 4) & splatWide(0xFF);
+}
+
+
+void horizontalBlur6_generic( const uint8_t *srcp, uint8_t *dstp, intptr_t src_stride, intptr_t dst_stride, intptr_t width, intptr_t height) {
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x += STEP) {
+            const vec m0 = load(&srcp[x - 2]);
+            const vec m1 = load(&srcp[x - 1]);
+            const vec m2 = load(&srcp[x]);
+            const vec m3 = load(&srcp[x + 1]);
+            const vec m4 = load(&srcp[x + 2]);
+
+            const wide lo = blur14641(wideLo(m0), wideLo(m1), wideLo(m2), wideLo(m3), wideLo(m4));
+            const wide hi = blur14641(wideHi(m0), wideHi(m1), wideHi(m2), wideHi(m3), wideHi(m4));
+
+            store(&dstp[x], packWide(lo, hi));
+        }
+
+        srcp += src_stride;
+        dstp += dst_stride;
+    }
+}
+
+
+// 0xFF where the mask is set and min <= val <= max.
+static inline vec acceptable(vec mask, vec val, vec min, vec max) {
+    return ~zeroMask(mask) & geMask(val, min) & geMask(max, val);
+}
+
+
+void buildFinalFrame_generic( const uint8_t *p2p, const uint8_t *p1p, const uint8_t *srcp, const uint8_t *n1p, const uint8_t *n2p, const uint8_t *m1p, const uint8_t *m2p, const uint8_t *m3p, const uint8_t *minp, const uint8_t *maxp, uint8_t *dstp, uint8_t *mapp, intptr_t src_stride, intptr_t msk_stride, intptr_t minmax_stride, intptr_t dst_stride, intptr_t width, intptr_t height, intptr_t map_only) {
+    const vec code_2 = splat(255);
+    const vec code_1 = splat(170);
+    const vec code_3 = splat(85);
+
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x += STEP) {
+            const vec p2 = load(&p2p[x]);
+            const vec p1 = load(&p1p[x]);
+            const vec s = load(&srcp[x]);
+            const vec n1 = load(&n1p[x]);
+            const vec n2 = load(&n2p[x]);
+            const vec min = load(&minp[x]);
+            const vec max = load(&maxp[x]);
+
+            // The first of the three that is masked and within min and max
+            // wins, in this order.
+            const vec v2 = blur121(p1, s, n1);
+            const vec v1 = blur121(p2, p1, s);
+            const vec v3 = blur121(s, n1, n2);
+
+            const vec ok2 = acceptable(load(&m2p[x]), v2, min, max);
+            const vec ok1 = ~ok2 & acceptable(load(&m1p[x]), v1, min, max);
+            const vec ok3 = ~(ok2 | ok1) & acceptable(load(&m3p[x]), v3, min, max);
+            const vec any = ok2 | ok1 | ok3;
+
+            const vec codes = (ok2 & code_2) | (ok1 & code_1) | (ok3 & code_3);
+            const vec vals = (ok2 & v2) | (ok1 & v1) | (ok3 & v3);
+
+            store(&dstp[x], (~any & load(&dstp[x])) | (map_only ? codes : vals));
+
+            if (mapp)
+                store(&mapp[x], (~any & load(&mapp[x])) | codes);
+        }
+
+        p2p += src_stride;
+        p1p += src_stride;
+        srcp += src_stride;
+        n1p += src_stride;
+        n2p += src_stride;
+        m1p += msk_stride;
+        m2p += msk_stride;
+        m3p += msk_stride;
+        minp += minmax_stride;
+        maxp += minmax_stride;
+        dstp += dst_stride;
+        if (mapp)
+            mapp += dst_stride;
+    }
+}
@@ -5,7 +5,7 @@
 #define zeroes _mm_setzero_si128()
 
 
-void buildFinalMask_sse2( const uint8_t *s1p, const uint8_t *s2p, const uint8_t *m1p, uint8_t *dstp, intptr_t stride, intptr_t width, intptr_t height, intptr_t thresh) {
+void buildFinalMask_sse2( const uint8_t *s1p, const uint8_t *s2p, const uint8_t *m1p, uint8_t *dstp, intptr_t src_stride, intptr_t dst_stride, intptr_t width, intptr_t height, intptr_t thresh) {
     __m128i th = _mm_set1_epi8(thresh - 1);
 
     for (int y = 0; y < height; y++) {
@@ -20,15 +20,15 @@ void buildFinalMask_sse2( const uint8_t *s1p, const uint8_t *s2p, const uint8_t
             _mm_store_si128((__m128i *)&dstp[x], m0);
         }
 
-        s1p += stride;
-        s2p += stride;
-        m1p += stride;
-        dstp += stride;
+        s1p += src_stride;
+        s2p += src_stride;
+        m1p += dst_stride;
+        dstp += dst_stride;
     }
 }
 
 
-void absDiff_sse2( const uint8_t *srcp1, const uint8_t *srcp2, uint8_t *dstp, intptr_t stride, intptr_t width, intptr_t height) {
+void absDiff_sse2( const uint8_t *srcp1, const uint8_t *srcp2, uint8_t *dstp, intptr_t src_stride, intptr_t dst_stride, intptr_t width, intptr_t height) {
     for (int y = 0; y < height; y++) {
         for (int x = 0; x < width; x += 16) {
             __m128i m0 = _mm_load_si128((const __m128i *)&srcp1[x]);
@@ -38,9 +38,9 @@ void absDiff_sse2( const uint8_t *srcp1, const uint8_t *srcp2, uint8_t *dstp, in
             _mm_store_si128((__m128i *)&dstp[x], m0);
         }
 
-        srcp1 += stride;
-        srcp2 += stride;
-        dstp += stride;
+        srcp1 += src_stride;
+        srcp2 += src_stride;
+        dstp += dst_stride;
     }
 }
 
@@ -85,7 +85,7 @@ void absDiffAndMinMaskThresh_sse2( const uint8_t *srcp1, const uint8_t *srcp2, u
 }
 
 
-void checkOscillation5_sse2( const uint8_t *p2p, const uint8_t *p1p, const uint8_t *s1p, const uint8_t *n1p, const uint8_t *n2p, uint8_t *dstp, intptr_t stride, intptr_t width, intptr_t height, intptr_t thresh) {
+void checkOscillation5_sse2( const uint8_t *p2p, const uint8_t *p1p, const uint8_t *s1p, const uint8_t *n1p, const uint8_t *n2p, uint8_t *dstp, intptr_t src_stride, intptr_t dst_stride, intptr_t width, intptr_t height, intptr_t thresh) {
     __m128i th = _mm_set1_epi8(thresh - 1);
 
     __m128i bytes_1 = _mm_set1_epi8(1);
@@ -133,17 +133,17 @@ void checkOscillation5_sse2( const uint8_t *p2p, const uint8_t *p1p, const uint8
             _mm_store_si128((__m128i *)&dstp[x], m1);
         }
 
-        p2p += stride;
-        p1p += stride;
-        s1p += stride;
-        n1p += stride;
-        n2p += stride;
-        dstp += stride;
+        p2p += src_stride;
+        p1p += src_stride;
+        s1p += src_stride;
+        n1p += src_stride;
+        n2p += src_stride;
+        dstp += dst_stride;
     }
 }
 
 
-void calcAverages_sse2( const uint8_t *s1p, const uint8_t *s2p, uint8_t *dstp, intptr_t stride, intptr_t width, intptr_t height) {
+void calcAverages_sse2( const uint8_t *s1p, const uint8_t *s2p, uint8_t *dstp, intptr_t src_stride, intptr_t dst_stride, intptr_t width, intptr_t height) {
     for (int y = 0; y < height; y++) {
         for (int x = 0; x < width; x += 16) {
             __m128i m0 = _mm_load_si128((const __m128i *)&s1p[x]);
@@ -152,9 +152,9 @@ void calcAverages_sse2( const uint8_t *s1p, const uint8_t *s2p, uint8_t *dstp, i
             _mm_store_si128((__m128i *)&dstp[x], m0);
         }
 
-        s1p += stride;
-        s2p += stride;
-        dstp += stride;
+        s1p += src_stride;
+        s2p += src_stride;
+        dstp += dst_stride;
     }
 }
 
@@ -196,6 +196,47 @@ void checkAvgOscCorrelation_sse2( const uint8_t *s1p, const uint8_t *s2p, const
 }
 
 
+void checkAvgOscCorrelationFields_sse2( const uint8_t *c1p, const uint8_t *p1p, const uint8_t *c2p, const uint8_t *p2p, const uint8_t *c3p, const uint8_t *p3p, const uint8_t *c4p, const uint8_t *p4p, uint8_t *dstp, intptr_t src_stride, intptr_t dst_stride, intptr_t width, intptr_t height, intptr_t thresh) {
+    __m128i th = _mm_set1_epi8(thresh - 1);
+
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x += 16) {
+            __m128i m0, m1, m4, m5;
+
+            m0 = m1 = _mm_avg_epu8(_mm_load_si128((const __m128i *)&c1p[x]), _mm_load_si128((const __m128i *)&p1p[x]));
+            m5 = _mm_avg_epu8(_mm_load_si128((const __m128i *)&c2p[x]), _mm_load_si128((const __m128i *)&p2p[x]));
+            m0 = _mm_min_epu8(m0, m5);
+            m1 = _mm_max_epu8(m1, m5);
+
+            m5 = _mm_avg_epu8(_mm_load_si128((const __m128i *)&c3p[x]), _mm_load_si128((const __m128i *)&p3p[x]));
+            m0 = _mm_min_epu8(m0, m5);
+            m1 = _mm_max_epu8(m1, m5);
+
+            m5 = _mm_avg_epu8(_mm_load_si128((const __m128i *)&c4p[x]), _mm_load_si128((const __m128i *)&p4p[x]));
+            m0 = _mm_min_epu8(m0, m5);
+            m1 = _mm_max_epu8(m1, m5);
+
+            m1 = _mm_subs_epu8(m1, m0);
+            m1 = _mm_subs_epu8(m1, th);
+            m1 = _mm_cmpeq_epi8(m1, zeroes);
+            m4 = _mm_load_si128((const __m128i *)&dstp[x]);
+            m1 = _mm_and_si128(m1, m4);
+            _mm_store_si128((__m128i *)&dstp[x], m1);
+        }
+
+        c1p += src_stride;
+        p1p += src_stride;
+        c2p += src_stride;
+        p2p += src_stride;
+        c3p += src_stride;
+        p3p += src_stride;
+        c4p += src_stride;
+        p4p += src_stride;
+        dstp += dst_stride;
+    }
+}
+
+
 void or3Masks_sse2( const uint8_t *s1p, const uint8_t *s2p, const uint8_t *s3p, uint8_t *dstp, intptr_t stride, intptr_t width, intptr_t height) {
     for (int y = 0; y < height; y++) {
         for (int x = 0; x < width; x += 16) {
@@ -246,6 +287,25 @@ void andMasks_sse2( const uint8_t *s1p, const uint8_t *s2p, uint8_t *dstp, intpt
 }
 
 
+void or4Masks_sse2( const uint8_t *s1p, const uint8_t *s2p, const uint8_t *s3p, const uint8_t *s4p, uint8_t *dstp, intptr_t stride, intptr_t width, intptr_t height) {
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x += 16) {
+            __m128i m0 = _mm_load_si128((const __m128i *)&s1p[x]);
+            m0 = _mm_or_si128(m0, _mm_load_si128((const __m128i *)&s2p[x]));
+            m0 = _mm_or_si128(m0, _mm_load_si128((const __m128i *)&s3p[x]));
+            m0 = _mm_or_si128(m0, _mm_load_si128((const __m128i *)&s4p[x]));
+            _mm_store_si128((__m128i *)&dstp[x], m0);
+        }
+
+        s1p += stride;
+        s2p += stride;
+        s3p += stride;
+        s4p += stride;
+        dstp += stride;
+    }
+}
+
+
 void checkSceneChange_sse2( const uint8_t *s1p, const uint8_t *s2p, intptr_t height, intptr_t width, intptr_t stride, int64_t *diffp) {
     __m128i sum = zeroes;
 
@@ -266,26 +326,26 @@ void checkSceneChange_sse2( const uint8_t *s1p, const uint8_t *s2p, intptr_t hei
 }
 
 
-void verticalBlur3_sse2( const uint8_t *srcp, uint8_t *dstp, intptr_t stride, intptr_t width, intptr_t height) {
+void verticalBlur3_sse2( const uint8_t *srcp, uint8_t *dstp, intptr_t src_stride, intptr_t dst_stride, intptr_t width, intptr_t height) {
     __m128i words_2 = _mm_set1_epi16(2);
 
     for (int x = 0; x < width; x += 16) {
         __m128i m0 = _mm_load_si128((const __m128i *)&srcp[x]);
-        __m128i m1 = _mm_load_si128((const __m128i *)&srcp[x + stride]);
+        __m128i m1 = _mm_load_si128((const __m128i *)&srcp[x + src_stride]);
         m0 = _mm_avg_epu8(m0, m1);
         _mm_store_si128((__m128i *)&dstp[x], m0);
     }
 
-    srcp += stride;
-    dstp += stride;
+    srcp += src_stride;
+    dstp += dst_stride;
 
     for (int y = 0; y < height - 2; y++) {
         for (int x = 0; x < width; x += 16) {
             __m128i m0, m1, m2, m3, m4, m5;
 
-            m0 = m3 = _mm_load_si128((const __m128i *)&srcp[x - stride]);
+            m0 = m3 = _mm_load_si128((const __m128i *)&srcp[x - src_stride]);
             m1 = m4 = _mm_load_si128((const __m128i *)&srcp[x]);
-            m2 = m5 = _mm_load_si128((const __m128i *)&srcp[x + stride]);
+            m2 = m5 = _mm_load_si128((const __m128i *)&srcp[x + src_stride]);
 
             m0 = _mm_unpacklo_epi8(m0, zeroes);
             m1 = _mm_unpacklo_epi8(m1, zeroes);
@@ -314,12 +374,12 @@ void verticalBlur3_sse2( const uint8_t *srcp, uint8_t *dstp, intptr_t stride, in
             _mm_store_si128((__m128i *)&dstp[x], m0);
         }
 
-        srcp += stride;
-        dstp += stride;
+        srcp += src_stride;
+        dstp += dst_stride;
     }
 
     for (int x = 0; x < width; x += 16) {
-        __m128i m0 = _mm_load_si128((const __m128i *)&srcp[x - stride]);
+        __m128i m0 = _mm_load_si128((const __m128i *)&srcp[x - src_stride]);
         __m128i m1 = _mm_load_si128((const __m128i *)&srcp[x]);
         m0 = _mm_avg_epu8(m0, m1);
         _mm_store_si128((__m128i *)&dstp[x], m0);
@@ -412,7 +472,7 @@ void minMax_sse2( const uint8_t *srcp, uint8_t *minp, uint8_t *maxp, intptr_t wi
 }
 
 
-void horizontalBlur3_sse2( const uint8_t *srcp, uint8_t *dstp, intptr_t stride, intptr_t width, intptr_t height) {
+void horizontalBlur3_sse2( const uint8_t *srcp, uint8_t *dstp, intptr_t src_stride, intptr_t dst_stride, intptr_t width, intptr_t height) {
     __m128i words_2 = _mm_set1_epi16(2);
 
     for (int y = 0; y < height; y++) {
@@ -450,13 +510,13 @@ void horizontalBlur3_sse2( const uint8_t *srcp, uint8_t *dstp, intptr_t stride,
             _mm_store_si128((__m128i *)&dstp[x], m0);
         }
 
-        srcp += stride;
-        dstp += stride;
+        srcp += src_stride;
+        dstp += dst_stride;
     }
 }
 
 
-void horizontalBlur6_sse2( const uint8_t *srcp, uint8_t *dstp, intptr_t stride, intptr_t width, intptr_t height) {
+void horizontalBlur6_sse2( const uint8_t *srcp, uint8_t *dstp, intptr_t src_stride, intptr_t dst_stride, intptr_t width, intptr_t height) {
     __m128i words_6 = _mm_set1_epi16(6);
     __m128i words_8 = _mm_set1_epi16(8);
 
@@ -510,7 +570,90 @@ void horizontalBlur6_sse2( const uint8_t *srcp, uint8_t *dstp, intptr_t stride,
             _mm_store_si128((__m128i *)&dstp[x], m0);
         }
 
-        srcp += stride;
-        dstp += stride;
+        srcp += src_stride;
+        dstp += dst_stride;
+    }
+}
+
+
+// (a + b * 2 + c + 2) / 4
+static inline __m128i blur121(__m128i a, __m128i b, __m128i c) {
+    const __m128i words_2 = _mm_set1_epi16(2);
+
+    __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zeroes), _mm_unpacklo_epi8(c, zeroes));
+    __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zeroes), _mm_unpackhi_epi8(c, zeroes));
+
+    lo = _mm_add_epi16(lo, _mm_slli_epi16(_mm_unpacklo_epi8(b, zeroes), 1));
+    hi = _mm_add_epi16(hi, _mm_slli_epi16(_mm_unpackhi_epi8(b, zeroes), 1));
+
+    lo = _mm_srli_epi16(_mm_add_epi16(lo, words_2), 2);
+    hi = _mm_srli_epi16(_mm_add_epi16(hi, words_2), 2);
+
+    return _mm_packus_epi16(lo, hi);
+}
+
+
+// 0xFF where the mask is set and min <= val <= max.
+static inline __m128i acceptable(__m128i mask, __m128i val, __m128i min, __m128i max) {
+    __m128i ok = _mm_and_si128(_mm_cmpeq_epi8(_mm_max_epu8(val, min), val),
+                               _mm_cmpeq_epi8(_mm_min_epu8(val, max), val));
+
+    return _mm_andnot_si128(_mm_cmpeq_epi8(mask, zeroes), ok);
+}
+
+
+void buildFinalFrame_sse2( const uint8_t *p2p, const uint8_t *p1p, const uint8_t *srcp, const uint8_t *n1p, const uint8_t *n2p, const uint8_t *m1p, const uint8_t *m2p, const uint8_t *m3p, const uint8_t *minp, const uint8_t *maxp, uint8_t *dstp, uint8_t *mapp, intptr_t src_stride, intptr_t msk_stride, intptr_t minmax_stride, intptr_t dst_stride, intptr_t width, intptr_t height, intptr_t map_only) {
+    __m128i code_2 = _mm_set1_epi8((char)255);
+    __m128i code_1 = _mm_set1_epi8((char)170);
+    __m128i code_3 = _mm_set1_epi8(85);
+
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x += 16) {
+            __m128i p2 = _mm_load_si128((const __m128i *)&p2p[x]);
+            __m128i p1 = _mm_load_si128((const __m128i *)&p1p[x]);
+            __m128i s = _mm_load_si128((const __m128i *)&srcp[x]);
+            __m128i n1 = _mm_load_si128((const __m128i *)&n1p[x]);
+            __m128i n2 = _mm_load_si128((const __m128i *)&n2p[x]);
+            __m128i min = _mm_load_si128((const __m128i *)&minp[x]);
+            __m128i max = _mm_load_si128((const __m128i *)&maxp[x]);
+
+            // The first of the three that is masked and within min and max
+            // wins, in this order.
+            __m128i v2 = blur121(p1, s, n1);
+            __m128i v1 = blur121(p2, p1, s);
+            __m128i v3 = blur121(s, n1, n2);
+
+            __m128i ok2 = acceptable(_mm_load_si128((const __m128i *)&m2p[x]), v2, min, max);
+            __m128i ok1 = _mm_andnot_si128(ok2, acceptable(_mm_load_si128((const __m128i *)&m1p[x]), v1, min, max));
+            __m128i ok3 = _mm_andnot_si128(_mm_or_si128(ok2, ok1), acceptable(_mm_load_si128((const __m128i *)&m3p[x]), v3, min, max));
+            __m128i any = _mm_or_si128(_mm_or_si128(ok2, ok1), ok3);
+
+            __m128i codes = _mm_or_si128(_mm_or_si128(_mm_and_si128(ok2, code_2), _mm_and_si128(ok1, code_1)), _mm_and_si128(ok3, code_3));
+            __m128i vals = _mm_or_si128(_mm_or_si128(_mm_and_si128(ok2, v2), _mm_and_si128(ok1, v1)), _mm_and_si128(ok3, v3));
+
+            __m128i d = _mm_load_si128((const __m128i *)&dstp[x]);
+            d = _mm_or_si128(_mm_andnot_si128(any, d), map_only ? codes : vals);
+            _mm_store_si128((__m128i *)&dstp[x], d);
+
+            if (mapp) {
+                __m128i m = _mm_load_si128((const __m128i *)&mapp[x]);
+                m = _mm_or_si128(_mm_andnot_si128(any, m), codes);
+                _mm_store_si128((__m128i *)&mapp[x], m);
+            }
+        }
+
+        p2p += src_stride;
+        p1p += src_stride;
+        srcp += src_stride;
+        n1p += src_stride;
+        n2p += src_stride;
+        m1p += msk_stride;
+        m2p += msk_stride;
+        m3p += msk_stride;
+        minp += minmax_stride;
+        maxp += minmax_stride;
+        dstp += dst_stride;
+        if (mapp)
+            mapp += dst_stride;
     }
 }
@@ -1,1343 +1,1636 @@
-/*
- **
- **   TComb is a temporal comb filter (it reduces cross-luminance (rainbowing)
- **   and cross-chrominance (dot crawl) artifacts in static areas of the picture).
- **   It will ONLY work with NTSC material, and WILL NOT work with telecined material
- **   where the rainbowing/dotcrawl was introduced prior to the telecine process!
- **   It must be used before ivtc or deinterlace.
- **
- **   Copyright (C) 2005-2006 Kevin Stone
- **
- **   VapourSynth port by dubhater
- **
- **   This program is free software; you can redistribute it and/or modify
- **   it under the terms of the GNU General Public License as published by
- **   the Free Software Foundation; either version 2 of the License, or
- **   (at your option) any later version.
- **
- **   This program is distributed in the hope that it will be useful,
- **   but WITHOUT ANY WARRANTY; without even the implied warranty of
- **   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
- **   GNU General Public License for more details.
- **
- **   You should have received a copy of the GNU General Public License
- **   along with this program; if not, write to the Free Software
- **   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
- */
-
-
-
-#include <VapourSynth.h>
-#include <VSHelper.h>
-
-
-#define min3(a,b,c) VSMIN(VSMIN(a,b),c)
-#define max3(a,b,c) VSMAX(VSMAX(a,b),c)
-#define min4(a,b,c,d) VSMIN(VSMIN(a,b),VSMIN(c,d))
-#define max4(a,b,c,d) VSMAX(VSMAX(a,b),VSMAX(c,d))
-
-
-#ifdef TCOMB_X86
-// Implemented in simd_sse2.c
-extern void buildFinalMask_sse2( const uint8_t *s1p, const uint8_t *s2p, const uint8_t *m1p, uint8_t *dstp, intptr_t stride, intptr_t width, intptr_t height, intptr_t thresh);
-extern void absDiff_sse2( const uint8_t *srcp1, const uint8_t *srcp2, uint8_t *dstp, intptr_t stride, intptr_t width, intptr_t height);
-extern void absDiffAndMinMask_sse2( const uint8_t *srcp1, const uint8_t *srcp2, uint8_t *dstp, intptr_t stride, intptr_t width, intptr_t height);
-extern void absDiffAndMinMaskThresh_sse2( const uint8_t *srcp1, const uint8_t *srcp2, uint8_t *dstp, intptr_t stride, intptr_t width, intptr_t height, intptr_t thresh);
-extern void checkOscillation5_sse2( const uint8_t *p2p, const uint8_t *p1p, const uint8_t *s1p, const uint8_t *n1p, const uint8_t *n2p, uint8_t *dstp, intptr_t stride, intptr_t width, intptr_t height, intptr_t thresh);
-extern void calcAverages_sse2( const uint8_t *s1p, const uint8_t *s2p, uint8_t *dstp, intptr_t stride, intptr_t width, intptr_t height);
-extern void checkAvgOscCorrelation_sse2( const uint8_t *s1p, const uint8_t *s2p, const uint8_t *s3p, const uint8_t *s4p, uint8_t *dstp, intptr_t stride, intptr_t width, intptr_t height, intptr_t thresh);
-extern void or3Masks_sse2( const uint8_t *s1p, const uint8_t *s2p, const uint8_t *s3p, uint8_t *dstp, intptr_t stride, intptr_t width, intptr_t height);
-extern void orAndMasks_sse2( const uint8_t *s1p, const uint8_t *s2p, uint8_t *dstp, intptr_t stride, intptr_t width, intptr_t height);
-extern void andMasks_sse2( const uint8_t *s1p, const uint8_t *s2p, uint8_t *dstp, intptr_t stride, intptr_t width, intptr_t height);
-extern void checkSceneChange_sse2( const uint8_t *s1p, const uint8_t *s2p, intptr_t height, intptr_t width, intptr_t stride, int64_t *diffp);
-extern void verticalBlur3_sse2( const uint8_t *srcp, uint8_t *dstp, intptr_t stride, intptr_t width, intptr_t height);
-extern void andNeighborsInPlace_sse2( uint8_t *srcp, intptr_t width, intptr_t height, intptr_t stride);
-extern void minMax_sse2( const uint8_t *srcp, uint8_t *minp, uint8_t *maxp, intptr_t width, intptr_t height, intptr_t src_stride, intptr_t min_stride, intptr_t thresh);
-extern void horizontalBlur3_sse2( const uint8_t *srcp, uint8_t *dstp, intptr_t stride, intptr_t width, intptr_t height);
-extern void horizontalBlur6_sse2( const uint8_t *srcp, uint8_t *dstp, intptr_t stride, intptr_t width, intptr_t height);
-#endif
-
-
-enum TCombModes {
-    LumaOnly = 0,
-    ChromaOnly,
-    LumaAndChroma
-};
-
-
-typedef struct {
-    VSNodeRef *node;
-    const VSVideoInfo *vi;
-
-    int mode;
-    int fthreshl;
-    int fthreshc;
-    int othreshl;
-    int othreshc;
-    int map;
-    double scthresh;
-
-    int start, stop;
-    int64_t diffmaxsc;
-} TCombData;
-
-
-
-static void copyPad(const VSFrameRef *src, VSFrameRef *dst, TCombData *d, const VSAPI *vsapi)
-{
-    for (int b = d->start; b < d->stop; ++b) {
-        int pitch = vsapi->getStride(dst, b);
-
-        vs_bitblt(vsapi->getWritePtr(dst, b) + pitch + 1, pitch,
-                vsapi->getReadPtr(src, b), vsapi->getStride(src, b),
-                vsapi->getFrameWidth(src, b) * d->vi->format->bytesPerSample, vsapi->getFrameHeight(src, b));
-        int height = vsapi->getFrameHeight(dst, b);
-        int width = vsapi->getFrameWidth(dst, b);
-        if (b == 0) {
-            height -= 2;
-            width -= 2;
-        }
-        uint8_t *dstp = vsapi->getWritePtr(dst, b) + pitch * 2;
-        for (int y = 2; y < height - 2; ++y) {
-            dstp[0] = dstp[1];
-            dstp[width - 1] = dstp[width - 2];
-            dstp += pitch;
-        }
-
-        dstp = vsapi->getWritePtr(dst, b);
-        memcpy(dstp, dstp + pitch, pitch);
-        memcpy(dstp + pitch * (height - 1), dstp + pitch * (height - 2), pitch);
-    }
-}
-
-
-static void MinMax(const VSFrameRef *src, VSFrameRef *dmin, VSFrameRef *dmax, VSFrameRef *pad, TCombData *d, const VSAPI *vsapi)
-{
-    copyPad(src, pad, d, vsapi);
-
-    for (int b = d->start; b < d->stop; ++b) {
-        const int src_pitch = vsapi->getStride(pad, b);
-        const uint8_t *srcp = vsapi->getReadPtr(pad, b) + src_pitch + 1;
-        const int width = vsapi->getFrameWidth(src, b);
-        const int height = vsapi->getFrameHeight(src, b);
-        uint8_t *dminp = vsapi->getWritePtr(dmin, b);
-        const int dmin_pitch = vsapi->getStride(dmin, b);
-        uint8_t *dmaxp = vsapi->getWritePtr(dmax, b);
-
-        const int thresh = b == 0 ? 2 : 8;
-
-#ifdef TCOMB_X86
-        minMax_sse2(srcp, dminp, dmaxp, width, height, src_pitch, dmin_pitch, thresh);
-#else
-        const uint8_t *srcpp = srcp - src_pitch;
-        const uint8_t *srcpn = srcp + src_pitch;
-
-        for (int y = 0; y < height; ++y) {
-            for (int x = 0; x < width; ++x) {
-                dminp[x] = VSMAX(VSMIN(VSMIN(VSMIN(VSMIN(srcpp[x - 1], srcpp[x]),
-                                    VSMIN(srcpp[x + 1], srcp[x - 1])),
-                                VSMIN(VSMIN(srcp[x], srcp[x + 1]),
-                                    VSMIN(srcpn[x - 1], srcpn[x]))), srcpn[x + 1]) - thresh, 0);
-                dmaxp[x] = VSMIN(VSMAX(VSMAX(VSMAX(VSMAX(srcpp[x - 1], srcpp[x]),
-                                    VSMAX(srcpp[x + 1], srcp[x - 1])),
-                                VSMAX(VSMAX(srcp[x], srcp[x + 1]),
-                                    VSMAX(srcpn[x - 1], srcpn[x]))), srcpn[x + 1]) + thresh, 255);
-            }
-            srcpp += src_pitch;
-            srcp += src_pitch;
-            srcpn += src_pitch;
-            dminp += dmin_pitch;
-            dmaxp += dmin_pitch;
-        }
-#endif
-    }
-}
-
-
-static void buildFinalFrame(const VSFrameRef *p2, const VSFrameRef *p1, const VSFrameRef *src,
-        const VSFrameRef *n1, const VSFrameRef *n2, const VSFrameRef *m1, const VSFrameRef *m2, const VSFrameRef *m3,
-        VSFrameRef *dst, VSFrameRef *min, VSFrameRef *max, VSFrameRef *pad, TCombData *d, const VSAPI *vsapi)
-{
-    if (!d->map)
-        for (int b = 0; b < d->vi->format->numPlanes; ++b)
-            memcpy(vsapi->getWritePtr(dst, b), vsapi->getReadPtr(src, b), vsapi->getStride(src, b) * vsapi->getFrameHeight(src, b));
-    else
-        for (int b = 0; b < d->vi->format->numPlanes; ++b)
-            memset(vsapi->getWritePtr(dst, b), 0, vsapi->getStride(dst, b) * vsapi->getFrameHeight(dst, b));
-
-    MinMax(src, min, max, pad, d, vsapi);
-
-    for (int b = d->start; b < d->stop; ++b) {
-        const uint8_t *p2p = vsapi->getReadPtr(p2, b);
-        const int p2_pitch = vsapi->getStride(p2, b);
-        const uint8_t *p1p = vsapi->getReadPtr(p1, b);
-        const int p1_pitch = vsapi->getStride(p1, b);
-        const uint8_t *srcp = vsapi->getReadPtr(src, b);
-        const int src_pitch = vsapi->getStride(src, b);
-        const int height = vsapi->getFrameHeight(src, b);
-        const int width = vsapi->getFrameWidth(src, b);
-        const uint8_t *n1p = vsapi->getReadPtr(n1, b);
-        const int n1_pitch = vsapi->getStride(n1, b);
-        const uint8_t *n2p = vsapi->getReadPtr(n2, b);
-        const int n2_pitch = vsapi->getStride(n2, b);
-        const uint8_t *m1p = vsapi->getReadPtr(m1, b);
-        const int m1_pitch = vsapi->getStride(m1, b);
-        const uint8_t *m2p = vsapi->getReadPtr(m2, b);
-        const int m2_pitch = vsapi->getStride(m2, b);
-        const uint8_t *m3p = vsapi->getReadPtr(m3, b);
-        const int m3_pitch = vsapi->getStride(m3, b);
-        const uint8_t *minp = vsapi->getReadPtr(min, b);
-        const int min_pitch = vsapi->getStride(min, b);
-        const uint8_t *maxp = vsapi->getReadPtr(max, b);
-        const int max_pitch = vsapi->getStride(max, b);
-        uint8_t *dstp = vsapi->getWritePtr(dst, b);
-        const int dst_pitch = vsapi->getStride(dst, b);
-
-        if (!d->map) {
-            for (int y = 0; y < height; ++y) {
-                for (int x = 0; x < width; ++x) {
-                    if (m2p[x]) {
-                        const int val = (p1p[x] + (srcp[x] * 2) + n1p[x] + 2) / 4;
-                        if (val >= minp[x] && val <= maxp[x]) {
-                            dstp[x] = val;
-                            continue;
-                        }
-                    }
-                    if (m1p[x]) {
-                        const int val = (p2p[x] + (p1p[x] * 2) + srcp[x] + 2) / 4;
-                        if (val >= minp[x] && val <= maxp[x]) {
-                            dstp[x] = val;
-                            continue;
-                        }
-                    }
-                    if (m3p[x]) {
-                        const int val = (srcp[x] + (n1p[x] * 2) + n2p[x] + 2) / 4;
-                        if (val >= minp[x] && val <= maxp[x]) {
-                            dstp[x] = val;
-                            continue;
-                        }
-                    }
-                }
-                m1p += m1_pitch;
-                m2p += m2_pitch;
-                m3p += m3_pitch;
-                p2p += p2_pitch;
-                p1p += p1_pitch;
-                srcp += src_pitch;
-                n1p += n1_pitch;
-                n2p += n2_pitch;
-                dstp += dst_pitch;
-                minp += min_pitch;
-                maxp += max_pitch;
-            }
-        } else {
-            for (int y = 0; y < height; ++y) {
-                for (int x = 0; x < width; ++x) {
-                    if (m2p[x]) {
-                        const int val = (p1p[x] + (srcp[x] * 2) + n1p[x] + 2) / 4;
-                        if (val >= minp[x] && val <= maxp[x]) {
-                            dstp[x] = 255;
-                            continue;
-                        }
-                    }
-                    if (m1p[x]) {
-                        const int val = (p2p[x] + (p1p[x] * 2) + srcp[x] + 2) / 4;
-                        if (val >= minp[x] && val <= maxp[x]) {
-                            dstp[x] = 170;
-                            continue;
-                        }
-                    }
-                    if (m3p[x]) {
-                        const int val = (srcp[x] + (n1p[x] * 2) + n2p[x] + 2) / 4;
-                        if (val >= minp[x] && val <= maxp[x]) {
-                            dstp[x] = 85;
-                            continue;
-                        }
-                    }
-                }
-                m1p += m1_pitch;
-                m2p += m2_pitch;
-                m3p += m3_pitch;
-                p2p += p2_pitch;
-                p1p += p1_pitch;
-                srcp += src_pitch;
-                n1p += n1_pitch;
-                n2p += n2_pitch;
-                dstp += dst_pitch;
-                minp += min_pitch;
-                maxp += max_pitch;
-            }
-        }
-    }
-}
-
-
-static void buildFinalMask(const VSFrameRef *s1, const VSFrameRef *s2, const VSFrameRef *m1,
-        VSFrameRef *dst, TCombData *d, const VSAPI *vsapi)
-{
-    for (int b = d->start; b < d->stop; ++b) {
-        const uint8_t *s1p = vsapi->getReadPtr(s1, b);
-        const int stride = vsapi->getStride(s1, b);
-        const int width = vsapi->getFrameWidth(s1, b);
-        const int height = vsapi->getFrameHeight(s1, b);
-        const uint8_t *s2p = vsapi->getReadPtr(s2, b);
-        const uint8_t *m1p = vsapi->getReadPtr(m1, b);
-        uint8_t *dstp = vsapi->getWritePtr(dst, b);
-
-        const int thresh = b == 0 ? d->othreshl : d->othreshc;
-
-#ifdef TCOMB_X86
-        buildFinalMask_sse2(s1p, s2p, m1p, dstp, stride, width, height, thresh);
-#else
-        for (int y = 0; y < height; ++y) {
-            for (int x = 0; x < width; ++x) {
-                if (m1p[x] && abs(s1p[x] - s2p[x]) < thresh)
-                    dstp[x] = 0xFF;
-                else
-                    dstp[x] = 0;
-            }
-            m1p += stride;
-            s1p += stride;
-            s2p += stride;
-            dstp += stride;
-        }
-#endif
-    }
-}
-
-
-static void andNeighborsInPlace(VSFrameRef *src, const VSAPI *vsapi)
-{
-    uint8_t *srcp = vsapi->getWritePtr(src, 0);
-    const int height = vsapi->getFrameHeight(src, 0);
-    const int width = vsapi->getFrameWidth(src, 0);
-    const int src_pitch = vsapi->getStride(src, 0);
-    uint8_t *srcpp = srcp - src_pitch;
-    uint8_t *srcpn = srcp + src_pitch;
-
-    srcp[0] &= (srcpn[0] | srcpn[1]);
-    for (int x = 1; x < width - 1; ++x)
-        srcp[x] &= (srcpn[x - 1] | srcpn[x] | srcpn[x + 1]);
-    srcp[width - 1] &= (srcpn[width - 2] | srcpn[width - 1]);
-    srcpp += src_pitch;
-    srcp += src_pitch;
-    srcpn += src_pitch;
-
-#ifdef TCOMB_X86
-    const int widtha = (width % 16) ? ((width / 16) * 16) : width - 16;
-
-    andNeighborsInPlace_sse2(srcp + 16, widtha - 16, height - 2, src_pitch);
-
-    for (int y = 1; y < height - 1; y++) {
-        srcp[0] &= (srcpp[0] | srcpp[1] | srcpn[0] | srcpn[1]);
-        for (int x = 1; x < 16; x++)
-            srcp[x] &= (srcpp[x - 1] | srcpp[x] | srcpp[x + 1] | srcpn[x - 1] | srcpn[x] | srcpn[x + 1]);
-
-        for (int x = widtha; x < width - 1; x++)
-            srcp[x] &= (srcpp[x - 1] | srcpp[x] | srcpp[x + 1] | srcpn[x - 1] | srcpn[x] | srcpn[x + 1]);
-        srcp[width - 1] &= (srcpp[width - 2] | srcpp[width - 1] | srcpn[width - 2] | srcpn[width - 1]);
-
-        srcpp += src_pitch;
-        srcp += src_pitch;
-        srcpn += src_pitch;
-    }
-#else
-    for (int y = 1; y < height - 1; ++y) {
-        srcp[0] &= (srcpp[0] | srcpp[1] | srcpn[0] | srcpn[1]);
-        for (int x = 1; x < width - 1; ++x)
-            srcp[x] &= (srcpp[x - 1] | srcpp[x] | srcpp[x + 1] | srcpn[x - 1] | srcpn[x] | srcpn[x + 1]);
-        srcp[width - 1] &= (srcpp[width - 2] | srcpp[width - 1] | srcpn[width - 2] | srcpn[width - 1]);
-        srcpp += src_pitch;
-        srcp += src_pitch;
-        srcpn += src_pitch;
-    }
-#endif
-
-    srcp[0] &= (srcpp[0] | srcpp[1]);
-    for (int x = 1; x < width - 1; ++x)
-        srcp[x] &= (srcpp[x - 1] | srcpp[x] | srcpp[x + 1]);
-    srcp[width - 1] &= (srcpp[width - 2] | srcpp[width - 1]);
-}
-
-
-static void absDiff(const VSFrameRef *src1, const VSFrameRef *src2, VSFrameRef *dst, const VSAPI *vsapi)
-{
-    const uint8_t *srcp1 = vsapi->getReadPtr(src1, 0);
-    const uint8_t *srcp2 = vsapi->getReadPtr(src2, 0);
-    uint8_t *dstp = vsapi->getWritePtr(dst, 0);
-    const int height = vsapi->getFrameHeight(src1, 0);
-    const int width = vsapi->getFrameWidth(src1, 0);
-    const int stride = vsapi->getStride(src1, 0);
-
-#ifdef TCOMB_X86
-    absDiff_sse2(srcp1, srcp2, dstp, stride, width, height);
-#else
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            dstp[x] = abs(srcp1[x] - srcp2[x]);
-        }
-        srcp1 += stride;
-        srcp2 += stride;
-        dstp += stride;
-    }
-#endif
-}
-
-
-static void absDiffAndMinMask(const VSFrameRef *src1, const VSFrameRef *src2, VSFrameRef *dst, const VSAPI *vsapi)
-{
-    const uint8_t *srcp1 = vsapi->getReadPtr(src1, 0);
-    const uint8_t *srcp2 = vsapi->getReadPtr(src2, 0);
-    uint8_t *dstp = vsapi->getWritePtr(dst, 0);
-    const int height = vsapi->getFrameHeight(src1, 0);
-    const int width = vsapi->getFrameWidth(src1, 0);
-    const int stride = vsapi->getStride(src1, 0);
-
-#ifdef TCOMB_X86
-    absDiffAndMinMask_sse2(srcp1, srcp2, dstp, stride, width, height);
-#else
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            const int diff = abs(srcp1[x] - srcp2[x]);
-            if (diff < dstp[x])
-                dstp[x] = diff;
-        }
-        srcp1 += stride;
-        srcp2 += stride;
-        dstp += stride;
-    }
-#endif
-}
-
-
-static void absDiffAndMinMaskThresh(const VSFrameRef *src1, const VSFrameRef *src2, VSFrameRef *dst,
-        TCombData *d, const VSAPI *vsapi)
-{
-    const uint8_t *srcp1 = vsapi->getReadPtr(src1, 0);
-    const uint8_t *srcp2 = vsapi->getReadPtr(src2, 0);
-    uint8_t *dstp = vsapi->getWritePtr(dst, 0);
-    const int height = vsapi->getFrameHeight(src1, 0);
-    const int width = vsapi->getFrameWidth(src1, 0);
-    const int stride = vsapi->getStride(src1, 0);
-
-    const int thresh = d->fthreshl;
-
-#ifdef TCOMB_X86
-    absDiffAndMinMaskThresh_sse2(srcp1, srcp2, dstp, stride, width, height, thresh);
-#else
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            const int diff = abs(srcp1[x] - srcp2[x]);
-            if (diff < dstp[x])
-                dstp[x] = diff;
-            if (dstp[x] < thresh)
-                dstp[x] = 0xFF;
-            else
-                dstp[x] = 0;
-        }
-        srcp1 += stride;
-        srcp2 += stride;
-        dstp += stride;
-    }
-#endif
-}
-
-
-static void checkOscillation5(const VSFrameRef *p2, const VSFrameRef *p1, const VSFrameRef *s1,
-        const VSFrameRef *n1, const VSFrameRef *n2, VSFrameRef *dst, TCombData *d, const VSAPI *vsapi)
-{
-    for (int b = d->start; b < d->stop; ++b) {
-        const uint8_t *p1p = vsapi->getReadPtr(p1, b);
-        const int stride = vsapi->getStride(p1, b);
-        const int width = vsapi->getFrameWidth(p1, b);
-        const int height = vsapi->getFrameHeight(p1, b);
-        const uint8_t *p2p = vsapi->getReadPtr(p2, b);
-        const uint8_t *s1p = vsapi->getReadPtr(s1, b);
-        const uint8_t *n1p = vsapi->getReadPtr(n1, b);
-        const uint8_t *n2p = vsapi->getReadPtr(n2, b);
-        uint8_t *dstp = vsapi->getWritePtr(dst, b);
-
-        const int thresh = b == 0 ? d->othreshl : d->othreshc;
-
-#ifdef TCOMB_X86
-        checkOscillation5_sse2(p2p, p1p, s1p, n1p, n2p, dstp, stride, width, height, thresh);
-#else
-        for (int y = 0; y < height; ++y) {
-            for (int x = 0; x < width; ++x) {
-                const int min31 = min3(p2p[x], s1p[x], n2p[x]);
-                const int max31 = max3(p2p[x], s1p[x], n2p[x]);
-                const int min22 = VSMIN(p1p[x], n1p[x]);
-                const int max22 = VSMAX(p1p[x], n1p[x]);
-                if (((min31 > max22) || max22 == 0 || (max31 < min22) || max31 == 0) &&
-                        max31 - min31 < thresh && max22 - min22 < thresh)
-                    dstp[x] = 0xFF;
-                else
-                    dstp[x] = 0;
-            }
-            p2p += stride;
-            p1p += stride;
-            s1p += stride;
-            n1p += stride;
-            n2p += stride;
-            dstp += stride;
-        }
-#endif
-    }
-}
-
-
-static void calcAverages(const VSFrameRef *s1, const VSFrameRef *s2, VSFrameRef *dst, TCombData *d, const VSAPI *vsapi)
-{
-    for (int b = d->start; b < d->stop; ++b) {
-        const uint8_t *s1p = vsapi->getReadPtr(s1, b);
-        const int stride = vsapi->getStride(s1, b);
-        const int height = vsapi->getFrameHeight(s1, b);
-        const int width = vsapi->getFrameWidth(s1, b);
-        const uint8_t *s2p = vsapi->getReadPtr(s2, b);
-        uint8_t *dstp = vsapi->getWritePtr(dst, b);
-
-#ifdef TCOMB_X86
-        calcAverages_sse2(s1p, s2p, dstp, stride, width, height);
-#else
-        for (int y = 0; y < height; ++y) {
-            for (int x = 0; x < width; ++x)
-                dstp[x] = (s1p[x] + s2p[x] + 1) / 2;
-            s1p += stride;
-            s2p += stride;
-            dstp += stride;
-        }
-#endif
-    }
-}
-
-
-static void checkAvgOscCorrelation(const VSFrameRef *s1, const VSFrameRef *s2, const VSFrameRef *s3,
-        const VSFrameRef *s4, VSFrameRef *dst, TCombData *d, const VSAPI *vsapi)
-{
-    for (int b = d->start; b < d->stop; ++b) {
-        const uint8_t *s1p = vsapi->getReadPtr(s1, b);
-        const int stride = vsapi->getStride(s1, b);
-        const int width = vsapi->getFrameWidth(s1, b);
-        const int height = vsapi->getFrameHeight(s1, b);
-        const uint8_t *s2p = vsapi->getReadPtr(s2, b);
-        const uint8_t *s3p = vsapi->getReadPtr(s3, b);
-        const uint8_t *s4p = vsapi->getReadPtr(s4, b);
-        uint8_t *dstp = vsapi->getWritePtr(dst, b);
-
-        const int thresh = b == 0 ? d->fthreshl : d->fthreshc;
-
-#ifdef TCOMB_X86
-        checkAvgOscCorrelation_sse2(s1p, s2p, s3p, s4p, dstp, stride, width, height, thresh);
-#else
-        for (int y = 0; y < height; ++y) {
-            for (int x = 0; x < width; ++x) {
-                if (max4(s1p[x], s2p[x], s3p[x], s4p[x]) -
-                        min4(s1p[x], s2p[x], s3p[x], s4p[x]) >= thresh)
-                    dstp[x] = 0;
-            }
-            s1p += stride;
-            s2p += stride;
-            s3p += stride;
-            s4p += stride;
-            dstp += stride;
-        }
-#endif
-    }
-}
-
-
-static void or3Masks(const VSFrameRef *s1, const VSFrameRef *s2, const VSFrameRef *s3,
-        VSFrameRef *dst, const VSAPI *vsapi)
-{
-    for (int b = 1; b < 3; ++b) {
-        const uint8_t *s1p = vsapi->getReadPtr(s1, b);
-        const int stride = vsapi->getStride(s1, b);
-        const int width = vsapi->getFrameWidth(s1, b);
-        const int height = vsapi->getFrameHeight(s1, b);
-        const uint8_t *s2p = vsapi->getReadPtr(s2, b);
-        const uint8_t *s3p = vsapi->getReadPtr(s3, b);
-        uint8_t *dstp = vsapi->getWritePtr(dst, b);
-
-#ifdef TCOMB_X86
-        or3Masks_sse2(s1p, s2p, s3p, dstp, stride, width, height);
-#else
-        for (int y = 0; y < height; ++y) {
-            for (int x = 0; x < width; ++x) {
-                dstp[x] = (s1p[x] | s2p[x] | s3p[x]);
-            }
-            s1p += stride;
-            s2p += stride;
-            s3p += stride;
-            dstp += stride;
-        }
-#endif
-    }
-}
-
-
-static void orAndMasks(const VSFrameRef *s1, const VSFrameRef *s2, VSFrameRef *dst, const VSAPI *vsapi)
-{
-    const uint8_t *s1p = vsapi->getReadPtr(s1, 0);
-    const int stride = vsapi->getStride(s1, 0);
-    const int height = vsapi->getFrameHeight(s1, 0);
-    const int width = vsapi->getFrameWidth(s1, 0);
-    const uint8_t *s2p = vsapi->getReadPtr(s2, 0);
-    uint8_t *dstp = vsapi->getWritePtr(dst, 0);
-
-#ifdef TCOMB_X86
-    orAndMasks_sse2(s1p, s2p, dstp, stride, width, height);
-#else
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            dstp[x] |= (s1p[x] & s2p[x]);
-        }
-        s1p += stride;
-        s2p += stride;
-        dstp += stride;
-    }
-#endif
-}
-
-
-static void andMasks(const VSFrameRef *s1, const VSFrameRef *s2, VSFrameRef *dst, const VSAPI *vsapi)
-{
-    const uint8_t *s1p = vsapi->getReadPtr(s1, 0);
-    const int stride = vsapi->getStride(s1, 0);
-    const int height = vsapi->getFrameHeight(s1, 0);
-    const int width = vsapi->getFrameWidth(s1, 0);
-    const uint8_t *s2p = vsapi->getReadPtr(s2, 0);
-    uint8_t *dstp = vsapi->getWritePtr(dst, 0);
-
-#ifdef TCOMB_X86
-    andMasks_sse2(s1p, s2p, dstp, stride, width, height);
-#else
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            dstp[x] = (s1p[x] & s2p[x]);
-        }
-        s1p += stride;
-        s2p += stride;
-        dstp += stride;
-    }
-#endif
-}
-
-
-static int checkSceneChange(const VSFrameRef *s1, const VSFrameRef *s2, TCombData *d, const VSAPI *vsapi)
-{
-    if (d->scthresh < 0.0)
-        return 0;
-
-    const uint8_t *s1p = vsapi->getReadPtr(s1, 0);
-    const uint8_t *s2p = vsapi->getReadPtr(s2, 0);
-    const int height = vsapi->getFrameHeight(s1, 0);
-    const int width = (vsapi->getFrameWidth(s1, 0) / 16) * 16;
-    const int stride = vsapi->getStride(s1, 0);
-
-    int64_t diff = 0;
-
-#ifdef TCOMB_X86
-    checkSceneChange_sse2(s1p, s2p, height, width, stride, &diff);
-#else
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; x += 4) {
-            diff += abs(s1p[x + 0] - s2p[x + 0]);
-            diff += abs(s1p[x + 1] - s2p[x + 1]);
-            diff += abs(s1p[x + 2] - s2p[x + 2]);
-            diff += abs(s1p[x + 3] - s2p[x + 3]);
-        }
-        s1p += stride;
-        s2p += stride;
-    }
-#endif
-
-    if (diff > d->diffmaxsc)
-        return 1;
-
-    return 0;
-}
-
-
-static void VerticalBlur3(const VSFrameRef *src, VSFrameRef *dst, const VSAPI *vsapi)
-{
-    const uint8_t *srcp = vsapi->getReadPtr(src, 0);
-    uint8_t *dstp = vsapi->getWritePtr(dst, 0);
-    const int stride = vsapi->getStride(src, 0);
-    const int width = vsapi->getFrameWidth(src, 0);
-    const int height = vsapi->getFrameHeight(src, 0);
-
-#ifdef TCOMB_X86
-    verticalBlur3_sse2(srcp, dstp, stride, width, height);
-#else
-    const uint8_t *srcpp = srcp - stride;
-    const uint8_t *srcpn = srcp + stride;
-
-    for (int x = 0; x < width; ++x)
-        dstp[x] = (srcp[x] + srcpn[x] + 1) / 2;
-    srcpp += stride;
-    srcp += stride;
-    srcpn += stride;
-    dstp += stride;
-    for (int y = 1; y < height - 1; ++y) {
-        for (int x = 0; x < width; ++x)
-            dstp[x] = (srcpp[x] + (srcp[x] * 2) + srcpn[x] + 2) / 4;
-        srcpp += stride;
-        srcp += stride;
-        srcpn += stride;
-        dstp += stride;
-    }
-    for (int x = 0; x < width; ++x)
-        dstp[x] = (srcpp[x] + srcp[x] + 1) / 2;
-#endif
-}
-
-
-static inline void horizontalBlur3_c( const uint8_t *srcp, uint8_t *dstp, int stride, int width, int height) {
-    for (int y = 0; y < height; ++y) {
-        dstp[0] = (srcp[0] + srcp[1] + 1) / 2;
-
-        for (int x = 1; x < width - 1; ++x)
-            dstp[x] = (srcp[x - 1] + (srcp[x] * 2) + srcp[x + 1] + 2) / 4;
-
-        dstp[width - 1] = (srcp[width - 2] + srcp[width - 1] + 1) / 2;
-
-        srcp += stride;
-        dstp += stride;
-    }
-}
-
-
-static void HorizontalBlur3(const VSFrameRef *src, VSFrameRef *dst, const VSAPI *vsapi)
-{
-    const uint8_t *srcp = vsapi->getReadPtr(src, 0);
-    uint8_t *dstp = vsapi->getWritePtr(dst, 0);
-    const int stride = vsapi->getStride(src, 0);
-    const int width = vsapi->getFrameWidth(src, 0);
-    const int height = vsapi->getFrameHeight(src, 0);
-
-#ifdef TCOMB_X86
-    if (width >= 16) {
-        const int widtha = (width / 16) * 16;
-
-        horizontalBlur3_sse2(srcp + 16, dstp + 16, stride, widtha - 32, height);
-
-        for (int y = 0; y < height; y++) {
-            dstp[0] = (srcp[0] + srcp[1] + 1) / 2;
-
-            for (int x = 1; x < 16; x++)
-                dstp[x] = (srcp[x - 1] + (srcp[x] * 2) + srcp[x + 1] + 2) / 4;
-
-            for (int x = widtha - 16; x < width - 1; x++)
-                dstp[x] = (srcp[x - 1] + (srcp[x] * 2) + srcp[x + 1] + 2) / 4;
-
-            dstp[width - 1] = (srcp[width - 2] + srcp[width - 1] + 1) / 2;
-
-            srcp += stride;
-            dstp += stride;
-        }
-    } else {
-        horizontalBlur3_c(srcp, dstp, stride, width, height);
-    }
-#else
-    horizontalBlur3_c(srcp, dstp, stride, width, height);
-#endif
-}
-
-
-static inline void horizontalBlur6_c( const uint8_t *srcp, uint8_t *dstp, int stride, int width, int height) {
-    for (int y = 0; y < height; ++y) {
-        dstp[0] = (srcp[0] * 6 + (srcp[1] * 8) + (srcp[2] * 2) + 8) / 16;
-        dstp[1] = (((srcp[0] + srcp[2]) * 4) + srcp[1] * 6 + (srcp[3] * 2) + 8) / 16;
-
-        for (int x = 2; x < width - 2; ++x)
-            dstp[x] = (srcp[x - 2] + ((srcp[x - 1] + srcp[x + 1]) * 4) + srcp[x] * 6 + srcp[x + 2] + 8) / 16;
-
-        dstp[width - 2] = ((srcp[width - 4] * 2) + ((srcp[width - 3] + srcp[width - 1]) * 4) + srcp[width - 2] * 6 + 8) / 16;
-        dstp[width - 1] = ((srcp[width - 3] * 2) + (srcp[width - 2] * 8) + srcp[width - 1] * 6 + 8) / 16;
-
-        srcp += stride;
-        dstp += stride;
-    }
-}
-
-
-static void HorizontalBlur6(const VSFrameRef *src, VSFrameRef *dst, const VSAPI *vsapi)
-{
-    const uint8_t *srcp = vsapi->getReadPtr(src, 0);
-    uint8_t *dstp = vsapi->getWritePtr(dst, 0);
-    const int stride = vsapi->getStride(src, 0);
-    const int width = vsapi->getFrameWidth(src, 0);
-    const int height = vsapi->getFrameHeight(src, 0);
-
-#ifdef TCOMB_X86
-    if (width >= 16) {
-        const int widtha = (width / 16) * 16;
-
-        horizontalBlur6_sse2(srcp + 16, dstp + 16, stride, widtha - 32, height);
-
-        for (int y = 0; y < height; y++) {
-            dstp[0] = (srcp[0] * 6 + (srcp[1] * 8) + (srcp[2] * 2) + 8) / 16;
-            dstp[1] = (((srcp[0] + srcp[2]) * 4) + srcp[1] * 6 + (srcp[3] * 2) + 8) / 16;
-
-            for (int x = 2; x < 16; x++)
-                dstp[x] = (srcp[x - 2] + ((srcp[x - 1] + srcp[x + 1]) * 4) + srcp[x] * 6 + srcp[x + 2] + 8) / 16;
-
-            for (int x = widtha - 16; x < width - 2; x++)
-                dstp[x] = (srcp[x - 2] + ((srcp[x - 1] + srcp[x + 1]) * 4) + srcp[x] * 6 + srcp[x + 2] + 8) / 16;
-
-            dstp[width - 2] = ((srcp[width - 4] * 2) + ((srcp[width - 3] + srcp[width - 1]) * 4) + srcp[width - 2] * 6 + 8) / 16;
-            dstp[width - 1] = ((srcp[width - 3] * 2) + (srcp[width - 2] * 8) + srcp[width - 1] * 6 + 8) / 16;
-
-            srcp += stride;
-            dstp += stride;
-        }
-    } else {
-        horizontalBlur6_c(srcp, dstp, stride, width, height);
-    }
-#else
-    horizontalBlur6_c(srcp, dstp, stride, width, height);
-#endif
-}
-
-
-static void VS_CC tcombInit(VSMap *in, VSMap *out, void **instanceData, VSNode *node, VSCore *core, const VSAPI *vsapi) {
-    TCombData *d = (TCombData *) * instanceData;
-
-    vsapi->setVideoInfo(d->vi, 1, node);
-}
-
-
-static const VSFrameRef *VS_CC tcombStage1GetFrame(int n, int activationReason, void **instanceData, void **frameData, VSFrameContext *frameCtx, VSCore *core, const VSAPI *vsapi) {
-    TCombData *d = (TCombData *) * instanceData;
-
-    if (activationReason == arInitial) {
-        vsapi->requestFrameFilter(VSMAX(0, n - 2), d->node, frameCtx);
-        vsapi->requestFrameFilter(n, d->node, frameCtx);
-    } else if (activationReason == arAllFramesReady) {
-        const VSFrameRef *prev = vsapi->getFrameFilter(VSMAX(0, n - 2), d->node, frameCtx);
-        const VSFrameRef *cur = vsapi->getFrameFilter(n, d->node, frameCtx);
-
-        VSFrameRef *dst = vsapi->copyFrame(cur, core);
-        VSMap *props = vsapi->getFramePropsRW(dst);
-
-        int sc = checkSceneChange(cur, prev, d, vsapi);
-        vsapi->propSetInt(props, "tcomb_sc", sc, paReplace);
-
-        if (d->mode == LumaOnly || d->mode == LumaAndChroma) {
-            VSFrameRef *blurred[6];
-            for (int i = 0; i < 6; i++)
-                blurred[i] = vsapi->newVideoFrame(d->vi->format, d->vi->width, d->vi->height, NULL, core);
-
-            HorizontalBlur3(cur, blurred[0], vsapi);
-            VerticalBlur3(cur, blurred[1], vsapi);
-            HorizontalBlur3(blurred[1], blurred[2], vsapi);
-            HorizontalBlur6(cur, blurred[3], vsapi);
-            VerticalBlur3(blurred[1], blurred[4], vsapi);
-            HorizontalBlur6(blurred[4], blurred[5], vsapi);
-
-            for (int i = 0; i < 6; i++) {
-                vsapi->propSetFrame(props, "tcomb_blurred", blurred[i], paAppend);
-                vsapi->freeFrame(blurred[i]);
-            }
-        }
-
-        vsapi->freeFrame(prev);
-        vsapi->freeFrame(cur);
-
-        return dst;
-    }
-
-    return 0;
-}
-
-
-static const VSFrameRef *VS_CC tcombStage2GetFrame(int n, int activationReason, void **instanceData, void **frameData, VSFrameContext *frameCtx, VSCore *core, const VSAPI *vsapi) {
-    TCombData *d = (TCombData *) * instanceData;
-
-    if (activationReason == arInitial) {
-        vsapi->requestFrameFilter(VSMAX(0, n - 2), d->node, frameCtx);
-        vsapi->requestFrameFilter(n, d->node, frameCtx);
-    } else if (activationReason == arAllFramesReady) {
-        const VSFrameRef *prev = vsapi->getFrameFilter(VSMAX(0, n - 2), d->node, frameCtx);
-        const VSFrameRef *cur = vsapi->getFrameFilter(n, d->node, frameCtx);
-
-        VSFrameRef *dst = vsapi->copyFrame(cur, core);
-        VSMap *props = vsapi->getFramePropsRW(dst);
-
-        if (d->mode == LumaOnly || d->mode == LumaAndChroma) {
-            const VSMap *prev_props = vsapi->getFramePropsRO(prev);
-            const VSMap *cur_props = vsapi->getFramePropsRO(cur);
-
-            const VSFrameRef *prev_blurred[6], *cur_blurred[6];
-
-            for (int i = 0; i < 6; i++) {
-                prev_blurred[i] = vsapi->propGetFrame(prev_props, "tcomb_blurred", i, NULL);
-                cur_blurred[i] = vsapi->propGetFrame(cur_props, "tcomb_blurred", i, NULL);
-            }
-
-            VSFrameRef *msk1 = vsapi->newVideoFrame(d->vi->format, d->vi->width, d->vi->height, NULL, core);    
-
-            absDiff(prev, cur, msk1, vsapi);
-            for (int i = 0; i < 5; ++i)
-                absDiffAndMinMask(prev_blurred[i], cur_blurred[i], msk1, vsapi);
-            absDiffAndMinMaskThresh(prev_blurred[5], cur_blurred[5], msk1, d, vsapi);
-
-            for (int i = 0; i < 6; i++) {
-                vsapi->freeFrame(prev_blurred[i]);
-                vsapi->freeFrame(cur_blurred[i]);
-            }
-
-            vsapi->propDeleteKey(props, "tcomb_blurred");
-
-            vsapi->propSetFrame(props, "tcomb_msk1", msk1, paReplace);
-            vsapi->freeFrame(msk1);
-        }
-
-        VSFrameRef *avg = vsapi->newVideoFrame(d->vi->format, d->vi->width, d->vi->height, NULL, core);    
-
-        calcAverages(cur, prev, avg, d, vsapi);
-
-        vsapi->propSetFrame(props, "tcomb_avg", avg, paReplace);
-        vsapi->freeFrame(avg);
-
-        vsapi->freeFrame(prev);
-        vsapi->freeFrame(cur);
-
-        return dst;
-    }
-
-    return 0;
-}
-
-
-static const VSFrameRef *VS_CC tcombStage3GetFrame(int n, int activationReason, void **instanceData, void **frameData, VSFrameContext *frameCtx, VSCore *core, const VSAPI *vsapi) {
-    TCombData *d = (TCombData *) * instanceData;
-
-    if (activationReason == arInitial) {
-        for (int i = -8; i <= 0; i += 2) {
-            vsapi->requestFrameFilter(VSMAX(0, n - i), d->node, frameCtx);
-        }
-    } else if (activationReason == arAllFramesReady) {
-        const VSFrameRef *src[5];
-
-        for (int i = -8; i <= 0; i += 2)
-            src[(i + 8) / 2] = vsapi->getFrameFilter(VSMAX(0, n - i), d->node, frameCtx);
-
-        VSFrameRef *dst = vsapi->copyFrame(src[4], core);
-        VSMap *props = vsapi->getFramePropsRW(dst);
-
-        VSFrameRef *omsk = vsapi->newVideoFrame(d->vi->format, d->vi->width, d->vi->height, NULL, core);    
-
-        checkOscillation5(src[0], src[1], src[2], src[3], src[4], omsk, d, vsapi);
-
-        const VSFrameRef *avg[4];
-        const VSMap *src_props[4];
-
-        for (int i = 0; i < 4; i++) {
-            src_props[i] = vsapi->getFramePropsRO(src[i + 1]);
-            avg[i] = vsapi->propGetFrame(src_props[i], "tcomb_avg", 0, NULL);
-        }
-
-        checkAvgOscCorrelation(avg[0], avg[1], avg[2], avg[3], omsk, d, vsapi);
-
-        for (int i = 0; i < 4; i++)
-            vsapi->freeFrame(avg[i]);
-
-        for (int i = 0; i < 5; i++)
-            vsapi->freeFrame(src[i]);
-
-        vsapi->propDeleteKey(props, "tcomb_avg");
-
-        vsapi->propSetFrame(props, "tcomb_omsk", omsk, paReplace);
-        vsapi->freeFrame(omsk);
-
-        return dst;
-    }
-
-    return 0;
-}
-
-
-static const VSFrameRef *VS_CC tcombStage4GetFrame(int n, int activationReason, void **instanceData, void **frameData, VSFrameContext *frameCtx, VSCore *core, const VSAPI *vsapi) {
-    TCombData *d = (TCombData *) * instanceData;
-
-    if (activationReason == arInitial) {
-        for (int i = -4; i <= 6; i += 2)
-            vsapi->requestFrameFilter(VSMIN(VSMAX(0, n + i), d->vi->numFrames - 1), d->node, frameCtx);
-    } else if (activationReason == arAllFramesReady) {
-        const VSFrameRef *src[6];
-
-        for (int i = -4; i <= 6; i += 2)
-            src[(i + 4) / 2] = vsapi->getFrameFilter(VSMIN(VSMAX(0, n + i), d->vi->numFrames - 1), d->node, frameCtx);
-
-        VSFrameRef *dst = vsapi->copyFrame(src[2], core);
-
-        int sc[6];
-        const VSFrameRef *omsk[6];
-        const VSFrameRef *msk1[6] = { 0 };
-
-        const VSMap *src_props[6];
-
-        for (int i = 1; i < 6; i++) {
-            src_props[i] = vsapi->getFramePropsRO(src[i]);
-            omsk[i] = vsapi->propGetFrame(src_props[i], "tcomb_omsk", 0, NULL);
-        }
-
-        for (int i = 1; i <= 2; i++) {
-            sc[i] = vsapi->propGetInt(src_props[i], "tcomb_sc", 0, NULL);
-            if (d->mode == LumaOnly || d->mode == LumaAndChroma)
-                msk1[i] = vsapi->propGetFrame(src_props[i], "tcomb_msk1", 0, NULL);
-        }
-
-        VSFrameRef *msk2 = vsapi->newVideoFrame(d->vi->format, d->vi->width, d->vi->height, NULL, core);    
-        VSFrameRef *tmp = vsapi->newVideoFrame(d->vi->format, d->vi->width, d->vi->height, NULL, core);    
-
-        if (sc[1] || sc[2]) {
-            for (int i = 0; i < d->vi->format->numPlanes; i++)
-                memset(vsapi->getWritePtr(msk2, i), 0, vsapi->getStride(msk2, i) * vsapi->getFrameHeight(msk2, i));
-        } else {
-            if (d->mode == LumaOnly || d->mode == LumaAndChroma) {
-                andMasks(omsk[1], omsk[2], tmp, vsapi);
-
-                for (int i = 2; i < 5; i++)
-                    orAndMasks(omsk[i], omsk[i + 1], tmp, vsapi);
-
-                andNeighborsInPlace(tmp, vsapi);
-
-                orAndMasks(msk1[1], msk1[2], tmp, vsapi);
-            }
-            if (d->mode == ChromaOnly || d->mode == LumaAndChroma) {
-                or3Masks(omsk[2], omsk[3], omsk[4], tmp, vsapi);
-            }
-            buildFinalMask(src[0], src[2], tmp, msk2, d, vsapi);
-        }
-
-        vsapi->freeFrame(tmp);
-
-        for (int i = 1; i < 6; i++)
-            vsapi->freeFrame(omsk[i]);
-
-        for (int i = 1; i <= 2; i++)
-            vsapi->freeFrame(msk1[i]);
-
-        for (int i = 0; i < 6; i++)
-            vsapi->freeFrame(src[i]);
-
-        VSMap *props = vsapi->getFramePropsRW(dst);
-        vsapi->propSetFrame(props, "tcomb_msk2", msk2, paReplace);
-        vsapi->freeFrame(msk2);
-
-        vsapi->propDeleteKey(props, "tcomb_msk1");
-        vsapi->propDeleteKey(props, "tcomb_omsk");
-        vsapi->propDeleteKey(props, "tcomb_sc");
-
-        return dst;
-    }
-
-    return 0;
-}
-
-
-static const VSFrameRef *VS_CC tcombStage5GetFrame(int n, int activationReason, void **instanceData, void **frameData, VSFrameContext *frameCtx, VSCore *core, const VSAPI *vsapi) {
-    TCombData *d = (TCombData *) * instanceData;
-
-    if (activationReason == arInitial) {
-        for (int i = -4; i <= 4; i += 2)
-            vsapi->requestFrameFilter(VSMIN(VSMAX(0, n + i), d->vi->numFrames - 1), d->node, frameCtx);
-    } else if (activationReason == arAllFramesReady) {
-        const VSFrameRef *src[5];
-
-        for (int i = -4; i <= 4; i += 2)
-            src[(i + 4) / 2] = vsapi->getFrameFilter(VSMIN(VSMAX(0, n + i), d->vi->numFrames - 1), d->node, frameCtx);
-
-        const VSMap *src_props[5];
-        const VSFrameRef *msk2[5];
-
-        for (int i = 2; i < 5; i++) {
-            src_props[i] = vsapi->getFramePropsRO(src[i]);
-            msk2[i] = vsapi->propGetFrame(src_props[i], "tcomb_msk2", 0, NULL);
-        }
-
-        VSFrameRef *dst = vsapi->newVideoFrame(d->vi->format, d->vi->width, d->vi->height, src[2], core);
-
-        VSFrameRef *min = vsapi->newVideoFrame(d->vi->format, d->vi->width, d->vi->height, NULL, core);
-        VSFrameRef *max = vsapi->newVideoFrame(d->vi->format, d->vi->width, d->vi->height, NULL, core);
-        VSFrameRef *pad = vsapi->newVideoFrame(d->vi->format, d->vi->width + 4, d->vi->height + 4, NULL, core);
-    
-        buildFinalFrame(src[0], src[1], src[2], src[3], src[4],
-                msk2[2], msk2[3], msk2[4],
-                dst, min, max, pad, d, vsapi);
-
-        vsapi->freeFrame(min);
-        vsapi->freeFrame(max);
-        vsapi->freeFrame(pad);
-
-        for (int i = 2; i < 5; i++)
-            vsapi->freeFrame(msk2[i]);
-
-        for (int i = 0; i < 5; i++)
-            vsapi->freeFrame(src[i]);
-
-        VSMap *props = vsapi->getFramePropsRW(dst);
-        vsapi->propDeleteKey(props, "tcomb_msk2");
-
-        return dst;
-    }
-
-    return 0;
-}
-
-
-static void VS_CC tcombFree(void *instanceData, VSCore *core, const VSAPI *vsapi) {
-    TCombData *d = (TCombData *)instanceData;
-
-    vsapi->freeNode(d->node);
-    free(d);
-}
-
-
-static int invokeCache(VSNodeRef **node, VSMap *out, VSPlugin *stdPlugin, const VSAPI *vsapi) {
-    VSMap *args = vsapi->createMap();
-    vsapi->propSetNode(args, "clip", *node, paReplace);
-    vsapi->freeNode(*node);
-    VSMap *ret = vsapi->invoke(stdPlugin, "Cache", args);
-    vsapi->freeMap(args);
-    if (!vsapi->getError(ret)) {
-        *node = vsapi->propGetNode(ret, "clip", 0, NULL);
-        vsapi->freeMap(ret);
-        return 1;
-    } else {
-        vsapi->setError(out, vsapi->getError(ret));
-        vsapi->freeMap(ret);
-        return 0;
-    }
-}
-
-
-static int invokeSeparateFields(VSNodeRef **node, VSMap *out, VSPlugin *stdPlugin, const VSAPI *vsapi) {
-    VSMap *args = vsapi->createMap();
-    vsapi->propSetNode(args, "clip", *node, paReplace);
-    vsapi->freeNode(*node);
-    vsapi->propSetInt(args, "tff", 1, paReplace);
-    VSMap *ret = vsapi->invoke(stdPlugin, "SeparateFields", args);
-    vsapi->freeMap(args);
-    if (!vsapi->getError(ret)) {
-        *node = vsapi->propGetNode(ret, "clip", 0, NULL);
-        vsapi->freeMap(ret);
-        return 1;
-    } else {
-        vsapi->setError(out, vsapi->getError(ret));
-        vsapi->freeMap(ret);
-        return 0;
-    }
-}
-
-
-static int invokeDoubleWeave(VSNodeRef **node, VSMap *out, VSPlugin *stdPlugin, const VSAPI *vsapi) {
-    VSMap *args = vsapi->createMap();
-    vsapi->propSetNode(args, "clip", *node, paReplace);
-    vsapi->freeNode(*node);
-    vsapi->propSetInt(args, "tff", 1, paReplace);
-    VSMap *ret = vsapi->invoke(stdPlugin, "DoubleWeave", args);
-    vsapi->freeMap(args);
-    if (!vsapi->getError(ret)) {
-        *node = vsapi->propGetNode(ret, "clip", 0, NULL);
-        vsapi->freeMap(ret);
-        return 1;
-    } else {
-        vsapi->setError(out, vsapi->getError(ret));
-        vsapi->freeMap(ret);
-        return 0;
-    }
-}
-
-
-static int invokeSelectEvery(VSNodeRef **node, VSMap *out, VSPlugin *stdPlugin, const VSAPI *vsapi) {
-    VSMap *args = vsapi->createMap();
-    vsapi->propSetNode(args, "clip", *node, paReplace);
-    vsapi->freeNode(*node);
-    vsapi->propSetInt(args, "cycle", 2, paReplace);
-    vsapi->propSetInt(args, "offsets", 0, paReplace);
-    VSMap *ret = vsapi->invoke(stdPlugin, "SelectEvery", args);
-    vsapi->freeMap(args);
-    if (!vsapi->getError(ret)) {
-        *node = vsapi->propGetNode(ret, "clip", 0, NULL);
-        vsapi->freeMap(ret);
-        return 1;
-    } else {
-        vsapi->setError(out, vsapi->getError(ret));
-        vsapi->freeMap(ret);
-        return 0;
-    }
-}
-
-
-static void VS_CC tcombCreate(const VSMap *in, VSMap *out, void *userData, VSCore *core, const VSAPI *vsapi) {
-    TCombData d;
-    TCombData *data;
-    int err;
-
-    d.mode = vsapi->propGetInt(in, "mode", 0, &err);
-    if (err)
-        d.mode = LumaAndChroma;
-
-    d.fthreshl = vsapi->propGetInt(in, "fthreshl", 0, &err);
-    if (err)
-        d.fthreshl = 4;
-
-    d.fthreshc = vsapi->propGetInt(in, "fthreshc", 0, &err);
-    if (err)
-        d.fthreshc = 5;
-
-    d.othreshl = vsapi->propGetInt(in, "othreshl", 0, &err);
-    if (err)
-        d.othreshl = 5;
-
-    d.othreshc = vsapi->propGetInt(in, "othreshc", 0, &err);
-    if (err)
-        d.othreshc = 6;
-
-    d.map = !!vsapi->propGetInt(in, "map", 0, &err);
-
-    d.scthresh = vsapi->propGetFloat(in, "scthresh", 0, &err);
-    if (err)
-        d.scthresh = 12.0;
-
-
-    if (d.mode < LumaOnly || d.mode > LumaAndChroma) {
-        vsapi->setError(out, "TComb: mode must be 0, 1, or 2.");
-        return;
-    }
-
-    if (d.fthreshl < 1 || d.fthreshl > 255) {
-        vsapi->setError(out, "TComb: fthreshl must be between 1 and 255 (inclusive).");
-        return;
-    }
-
-    if (d.fthreshc < 1 || d.fthreshc > 255) {
-        vsapi->setError(out, "TComb: fthreshc must be between 1 and 255 (inclusive).");
-        return;
-    }
-
-    if (d.othreshl < 1 || d.othreshl > 255) {
-        vsapi->setError(out, "TComb: othreshl must be between 1 and 255 (inclusive).");
-        return;
-    }
-
-    if (d.othreshc < 1 || d.othreshc > 255) {
-        vsapi->setError(out, "TComb: othreshc must be between 1 and 255 (inclusive).");
-        return;
-    }
-
-    if (d.scthresh > 100.0) {
-        vsapi->setError(out, "TComb: scthresh must not be more than 100.");
-        return;
-    }
-
-    d.node = vsapi->propGetNode(in, "clip", 0, 0);
-    d.vi = vsapi->getVideoInfo(d.node);
-
-    if (!isConstantFormat(d.vi) ||
-        (d.vi->format->colorFamily != cmGray && d.vi->format->colorFamily != cmYUV) ||
-        d.vi->format->sampleType != stInteger ||
-        d.vi->format->bitsPerSample != 8) {
-        vsapi->setError(out, "TComb: Input must be 8 bit Gray or YUV with constant format and dimensions.");
-        vsapi->freeNode(d.node);
-        return;
-    }
-
-    if (d.vi->format->colorFamily == cmGray && d.mode > LumaOnly) {
-        vsapi->setError(out, "TComb: Mode must be 0 when input is Gray.");
-        vsapi->freeNode(d.node);
-        return;
-    }
-
-    d.start = 0;
-    d.stop = 3;
-
-    if (d.mode == LumaOnly)
-        d.stop = 1;
-    if (d.mode == ChromaOnly)
-        d.start = 1;
-
-    VSPlugin *stdPlugin = vsapi->getPluginById("com.vapoursynth.std", core);
-
-    if (!invokeSeparateFields(&d.node, out, stdPlugin, vsapi))
-        return;
-
-    // It's rather different after SeparateFields.
-    d.vi = vsapi->getVideoInfo(d.node);
-
-    d.diffmaxsc = (int64_t)((d.vi->width / 16) * 16) * d.vi->height * 219;
-    if (d.scthresh >= 0.0)
-        d.diffmaxsc = (int64_t)(d.diffmaxsc * d.scthresh / 100.0);
-
-    if (!invokeCache(&d.node, out, stdPlugin, vsapi))
-        return;
-    
-    data = malloc(sizeof(d));
-    *data = d;
-    vsapi->createFilter(in, out, "TCombStage1", tcombInit, tcombStage1GetFrame, tcombFree, fmParallel, 0, data, core);
-    d.node = vsapi->propGetNode(out, "clip", 0, NULL);
-    if (!invokeCache(&d.node, out, stdPlugin, vsapi))
-        return;
-    vsapi->clearMap(out);
-
-    data = malloc(sizeof(d));
-    *data = d;
-    vsapi->createFilter(in, out, "TCombStage2", tcombInit, tcombStage2GetFrame, tcombFree, fmParallel, 0, data, core);
-    d.node = vsapi->propGetNode(out, "clip", 0, NULL);
-    if (!invokeCache(&d.node, out, stdPlugin, vsapi))
-        return;
-    vsapi->clearMap(out);
-
-    data = malloc(sizeof(d));
-    *data = d;
-    vsapi->createFilter(in, out, "TCombStage3", tcombInit, tcombStage3GetFrame, tcombFree, fmParallel, 0, data, core);
-    d.node = vsapi->propGetNode(out, "clip", 0, NULL);
-    if (!invokeCache(&d.node, out, stdPlugin, vsapi))
-        return;
-    vsapi->clearMap(out);
-
-    data = malloc(sizeof(d));
-    *data = d;
-    vsapi->createFilter(in, out, "TCombStage4", tcombInit, tcombStage4GetFrame, tcombFree, fmParallel, 0, data, core);
-    d.node = vsapi->propGetNode(out, "clip", 0, NULL);
-    if (!invokeCache(&d.node, out, stdPlugin, vsapi))
-        return;
-    vsapi->clearMap(out);
-
-    data = malloc(sizeof(d));
-    *data = d;
-    vsapi->createFilter(in, out, "TComb", tcombInit, tcombStage5GetFrame, tcombFree, fmParallel, 0, data, core);
-    d.node = vsapi->propGetNode(out, "clip", 0, NULL);
-
-    if (!invokeDoubleWeave(&d.node, out, stdPlugin, vsapi))
-        return;
-
-    if (!invokeCache(&d.node, out, stdPlugin, vsapi))
-        return;
-
-    if (!invokeSelectEvery(&d.node, out, stdPlugin, vsapi))
-        return;
-
-    vsapi->propSetNode(out, "clip", d.node, paReplace);
-    vsapi->freeNode(d.node);
-
-    return;
-}
-
-
-VS_EXTERNAL_API(void) VapourSynthPluginInit(VSConfigPlugin configFunc, VSRegisterFunction registerFunc, VSPlugin *plugin) {
-    configFunc("com.nodame.tcomb", "tcomb", "Dotcrawl and rainbow remover", VAPOURSYNTH_API_VERSION, 1, plugin);
-    registerFunc("TComb",
-                 "clip:clip;"
-                 "mode:int:opt;"
-                 "fthreshl:int:opt;"
-                 "fthreshc:int:opt;"
-                 "othreshl:int:opt;"
-                 "othreshc:int:opt;"
-                 "map:int:opt;"
-                 "scthresh:float:opt;",
-                 tcombCreate, 0, plugin);
-}
+/*
+ **
+ **   TComb is a temporal comb filter (it reduces cross-luminance (rainbowing)
+ **   and cross-chrominance (dot crawl) artifacts in static areas of the picture).
+ **   It will ONLY work with NTSC material, and WILL NOT work with telecined material
+ **   where the rainbowing/dotcrawl was introduced prior to the telecine process!
+ **   It must be used before ivtc or deinterlace.
+ **
+ **   Copyright (C) 2005-2006 Kevin Stone
+ **
+ **   VapourSynth port by dubhater
+ **
+ **   This program is free software; you can redistribute it and/or modify
+ **   it under the terms of the GNU General Public License as published by
+ **   the Free Software Foundation; either version 2 of the License, or
+ **   (at your option) any later version.
+ **
+ **   This program is distributed in the hope that it will be useful,
+ **   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ **   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ **   GNU General Public License for more details.
+ **
+ **   You should have received a copy of the GNU General Public License
+ **   along with this program; if not, write to the Free Software
+ **   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <VapourSynth.h>
+#include <VSHelper.h>
+
+#include "tcomb_core.h"
+
+
+// How many times each stage computed each field. When std.Cache drops an
+// intermediate that a neighbour still needs, the stage that produced it runs
+// again for the same field. Shared by all five stages of one TComb instance.
+typedef struct {
+    int refcount;
+
+    int numFields;
+    uint32_t *computed[5];
+    int64_t recomputed[5];
+} TCombStats;
+
+
+// Stage 4's pairs of omsk from the fields processed recently. Field n's
+// pair is in slot (n + 2) % numSlots. Requests arrive roughly in order, so
+// most pairs are found here; the others are computed again.
+typedef struct {
+    pthread_mutex_t lock;
+
+    int numSlots;
+    int *fields;
+    const VSFrameRef **frames;
+} TCombPairs;
+
+
+typedef struct {
+    VSNodeRef *node;
+    const VSVideoInfo *vi;
+
+    TCombFilter filter;
+
+    TCombStats *stats;
+    int stage;
+
+    const VSFormat *gray;           // of the luma-only intermediates
+
+    TCombPairs *pairs;              // Stage 4, when luma is processed
+    TCombMaskWriter *mask_writer;   // Stage 4, with write_masks
+    char *mask_path;
+    TCombMaskReader *mask_reader;   // Stage 5, with read_masks
+
+    VSNodeRef *clip;                // with analyze, the frames passed through
+    int stride;                     // with analyze, every stride-th field is examined
+
+    int both;                       // with both, Stage 5 also attaches the map
+    int split;                      // after Stage 5 with both: which clip to return
+} TCombData;
+
+
+enum TCombSplits {
+    SplitFiltered = 1,
+    SplitMap
+};
+
+
+static void statsCount(TCombStats *stats, int stage, int n)
+{
+    if (__atomic_fetch_add(&stats->computed[stage][n], 1, __ATOMIC_RELAXED))
+        __atomic_fetch_add(&stats->recomputed[stage], 1, __ATOMIC_RELAXED);
+}
+
+
+static void statsLog(const TCombStats *stats, const VSAPI *vsapi)
+{
+    uint32_t worst = 0;
+    int worst_stage = 0;
+    int worst_field = 0;
+
+    for (int s = 0; s < 5; s++) {
+        for (int n = 0; n < stats->numFields; n++) {
+            if (stats->computed[s][n] > worst) {
+                worst = stats->computed[s][n];
+                worst_stage = s;
+                worst_field = n;
+            }
+        }
+    }
+
+    char msg[256];
+    int len = snprintf(msg, sizeof(msg),
+                       "TComb: redundant computations per stage: %" PRId64 ", %" PRId64 ", %" PRId64 ", %" PRId64 ", %" PRId64 ".",
+                       stats->recomputed[0], stats->recomputed[1], stats->recomputed[2], stats->recomputed[3], stats->recomputed[4]);
+
+    if (worst > 1)
+        snprintf(msg + len, sizeof(msg) - len, " Worst: stage %d computed field %d %u times.", worst_stage + 1, worst_field, worst);
+
+    vsapi->logMessage(mtDebug, msg);
+}
+
+
+static void setRecomputed(VSMap *props, TCombStats *stats, const VSAPI *vsapi)
+{
+    int64_t recomputed[5];
+    for (int i = 0; i < 5; i++)
+        recomputed[i] = __atomic_load_n(&stats->recomputed[i], __ATOMIC_RELAXED);
+    vsapi->propSetIntArray(props, "TCombRecomputed", recomputed, 5);
+}
+
+
+static TCombFrame readView(const VSFrameRef *frame, const VSAPI *vsapi)
+{
+    TCombFrame view = { { NULL }, { 0 } };
+
+    for (int b = 0; b < vsapi->getFrameFormat(frame)->numPlanes; ++b) {
+        view.data[b] = (uint8_t *)vsapi->getReadPtr(frame, b);
+        view.stride[b] = vsapi->getStride(frame, b);
+    }
+
+    return view;
+}
+
+
+// Only the planes the filter processes, unless filter is NULL. The others
+// may be shared with another frame, and asking to write them would make
+// VapourSynth copy them.
+static TCombFrame writeView(VSFrameRef *frame, const TCombFilter *filter, const VSAPI *vsapi)
+{
+    TCombFrame view = { { NULL }, { 0 } };
+
+    const int num_planes = vsapi->getFrameFormat(frame)->numPlanes;
+    const int start = filter ? filter->start : 0;
+    const int stop = filter ? VSMIN(filter->stop, num_planes) : num_planes;
+
+    for (int b = start; b < stop; ++b) {
+        view.data[b] = vsapi->getWritePtr(frame, b);
+        view.stride[b] = vsapi->getStride(frame, b);
+    }
+
+    return view;
+}
+
+
+// Intermediates that only hold luma are Gray.
+static VSFrameRef *newLumaFrame(const TCombData *d, VSCore *core, const VSAPI *vsapi)
+{
+    return vsapi->newVideoFrame(d->gray, d->vi->width, d->vi->height, NULL, core);
+}
+
+
+// Intermediates holding the planes the filter processes. In mode 1 the luma
+// plane is borrowed from field, if given, instead of being allocated. It's
+// never written.
+static VSFrameRef *newPlanesFrame(const TCombData *d, const VSFrameRef *field, int width, int height, VSCore *core, const VSAPI *vsapi)
+{
+    if (d->filter.params.mode == LumaOnly)
+        return vsapi->newVideoFrame(d->gray, width, height, NULL, core);
+
+    if (d->filter.params.mode == ChromaOnly && field) {
+        const VSFrameRef *planes[3] = { field, NULL, NULL };
+        const int plane_numbers[3] = { 0, 1, 2 };
+        return vsapi->newVideoFrame2(d->vi->format, width, height, planes, plane_numbers, NULL, core);
+    }
+
+    return vsapi->newVideoFrame(d->vi->format, width, height, NULL, core);
+}
+
+
+// Room for the pairs of fields n - 2 ... n + 5, and for the fields the
+// other threads are working on.
+static int pairSlots(int num_threads)
+{
+    return 8 + 2 * num_threads;
+}
+
+
+static TCombPairs *pairsCreate(int num_slots)
+{
+    TCombPairs *pairs = malloc(sizeof(TCombPairs));
+    pthread_mutex_init(&pairs->lock, NULL);
+    pairs->numSlots = num_slots;
+    pairs->fields = malloc(num_slots * sizeof(int));
+    pairs->frames = calloc(num_slots, sizeof(VSFrameRef *));
+
+    for (int i = 0; i < num_slots; i++)
+        pairs->fields[i] = -num_slots;
+
+    return pairs;
+}
+
+
+static void pairsFree(TCombPairs *pairs, const VSAPI *vsapi)
+{
+    if (!pairs)
+        return;
+
+    for (int i = 0; i < pairs->numSlots; i++)
+        vsapi->freeFrame(pairs->frames[i]);
+
+    pthread_mutex_destroy(&pairs->lock);
+    free(pairs->fields);
+    free(pairs->frames);
+    free(pairs);
+}
+
+
+// The pair of omsk_a (field n) and omsk_b (field n + 2).
+static const VSFrameRef *pairsGet(const TCombData *d, int n, const TCombFrame *omsk_a, const TCombFrame *omsk_b, VSCore *core, const VSAPI *vsapi)
+{
+    TCombPairs *pairs = d->pairs;
+    const int slot = (n + 2) % pairs->numSlots;
+    const VSFrameRef *found = NULL;
+
+    pthread_mutex_lock(&pairs->lock);
+    if (pairs->fields[slot] == n)
+        found = vsapi->cloneFrameRef(pairs->frames[slot]);
+    pthread_mutex_unlock(&pairs->lock);
+
+    if (found)
+        return found;
+
+    VSFrameRef *pair = newLumaFrame(d, core, vsapi);
+    TCombFrame pair_view = writeView(pair, &d->filter, vsapi);
+
+    tcombStage4Pair(&d->filter, omsk_a, omsk_b, &pair_view);
+
+    const VSFrameRef *old = NULL;
+
+    pthread_mutex_lock(&pairs->lock);
+    if (pairs->fields[slot] != n) {
+        old = pairs->frames[slot];
+        pairs->frames[slot] = vsapi->cloneFrameRef(pair);
+        pairs->fields[slot] = n;
+    }
+    pthread_mutex_unlock(&pairs->lock);
+
+    vsapi->freeFrame(old);
+
+    return pair;
+}
+
+
+static void VS_CC tcombInit(VSMap *in, VSMap *out, void **instanceData, VSNode *node, VSCore *core, const VSAPI *vsapi) {
+    TCombData *d = (TCombData *) * instanceData;
+
+    vsapi->setVideoInfo(d->vi, 1, node);
+}
+
+
+static const VSFrameRef *VS_CC tcombStage1GetFrame(int n, int activationReason, void **instanceData, void **frameData, VSFrameContext *frameCtx, VSCore *core, const VSAPI *vsapi) {
+    TCombData *d = (TCombData *) * instanceData;
+
+    if (activationReason == arInitial) {
+        vsapi->requestFrameFilter(VSMAX(0, n - 2), d->node, frameCtx);
+        vsapi->requestFrameFilter(n, d->node, frameCtx);
+        if (n + 2 < d->vi->numFrames && !d->filter.params.lowmem)
+            vsapi->requestFrameFilter(n + 2, d->node, frameCtx);
+    } else if (activationReason == arAllFramesReady) {
+        statsCount(d->stats, d->stage, n);
+
+        const VSFrameRef *prev = vsapi->getFrameFilter(VSMAX(0, n - 2), d->node, frameCtx);
+        const VSFrameRef *cur = vsapi->getFrameFilter(n, d->node, frameCtx);
+        const VSFrameRef *next = NULL;
+        if (n + 2 < d->vi->numFrames && !d->filter.params.lowmem)
+            next = vsapi->getFrameFilter(n + 2, d->node, frameCtx);
+
+        VSFrameRef *dst = vsapi->copyFrame(cur, core);
+        VSMap *props = vsapi->getFramePropsRW(dst);
+
+        const TCombFrame prev_view = readView(prev, vsapi);
+        const TCombFrame cur_view = readView(cur, vsapi);
+
+        const int dup = tcombFieldsEqual(&d->filter, &prev_view, &cur_view);
+        vsapi->propSetInt(props, "tcomb_dup", dup, paReplace);
+
+        // The blurs are read by Stage 2 for fields n and n + 2 (and 1 and 2
+        // when n is 0), but only if the field it works on isn't a duplicate.
+        // With lowmem Stage 2 makes them itself.
+        int need_blurs = (n == 0 || !dup) && !d->filter.params.lowmem;
+        if (!need_blurs && next) {
+            const TCombFrame next_view = readView(next, vsapi);
+            need_blurs = !tcombFieldsEqual(&d->filter, &cur_view, &next_view);
+        }
+
+        const int blur_count = tcombBlurCount(&d->filter);
+        VSFrameRef *blurred[6] = { NULL };
+        TCombFrame blurred_views[6];
+        VSFrameRef *tmp = NULL;
+        TCombFrame tmp_view = { { NULL }, { 0 } };
+
+        if (tcombFilterProcessesLuma(&d->filter) && need_blurs) {
+            for (int i = 0; i < blur_count; i++) {
+                blurred[i] = newLumaFrame(d, core, vsapi);
+                blurred_views[i] = writeView(blurred[i], &d->filter, vsapi);
+            }
+
+            if (d->filter.params.preset == PresetFast) {
+                tmp = newLumaFrame(d, core, vsapi);
+                tmp_view = writeView(tmp, &d->filter, vsapi);
+            }
+        }
+
+        int sc = tcombStage1(&d->filter, &prev_view, &cur_view, need_blurs ? blurred_views : NULL, &tmp_view);
+        vsapi->propSetInt(props, "tcomb_sc", sc, paReplace);
+
+        vsapi->freeFrame(tmp);
+
+        if (tcombFilterProcessesLuma(&d->filter) && need_blurs) {
+            for (int i = 0; i < blur_count; i++) {
+                vsapi->propSetFrame(props, "tcomb_blurred", blurred[i], paAppend);
+                vsapi->freeFrame(blurred[i]);
+            }
+        }
+
+        vsapi->freeFrame(prev);
+        vsapi->freeFrame(cur);
+        vsapi->freeFrame(next);
+
+        return dst;
+    }
+
+    return 0;
+}
+
+
+static const VSFrameRef *VS_CC tcombStage2GetFrame(int n, int activationReason, void **instanceData, void **frameData, VSFrameContext *frameCtx, VSCore *core, const VSAPI *vsapi) {
+    TCombData *d = (TCombData *) * instanceData;
+
+    if (activationReason == arInitial) {
+        vsapi->requestFrameFilter(VSMAX(0, n - 2), d->node, frameCtx);
+        vsapi->requestFrameFilter(n, d->node, frameCtx);
+    } else if (activationReason == arAllFramesReady) {
+        statsCount(d->stats, d->stage, n);
+
+        const VSFrameRef *prev = vsapi->getFrameFilter(VSMAX(0, n - 2), d->node, frameCtx);
+        const VSFrameRef *cur = vsapi->getFrameFilter(n, d->node, frameCtx);
+
+        VSFrameRef *dst = vsapi->copyFrame(cur, core);
+        VSMap *props = vsapi->getFramePropsRW(dst);
+
+        const TCombFrame prev_view = readView(prev, vsapi);
+        const TCombFrame cur_view = readView(cur, vsapi);
+
+        const VSFrameRef *prev_blurred[6] = { NULL }, *cur_blurred[6] = { NULL };
+        TCombFrame prev_blurred_views[6], cur_blurred_views[6];
+
+        VSFrameRef *msk1 = NULL;
+        TCombFrame msk1_view = { { NULL }, { 0 } };
+
+        const int dup = !!vsapi->propGetInt(vsapi->getFramePropsRO(cur), "tcomb_dup", 0, NULL);
+        const int lowmem = d->filter.params.lowmem;
+
+        if (tcombFilterProcessesLuma(&d->filter)) {
+            if (!dup && !lowmem) {
+                const VSMap *prev_props = vsapi->getFramePropsRO(prev);
+                const VSMap *cur_props = vsapi->getFramePropsRO(cur);
+
+                for (int i = 0; i < tcombBlurCount(&d->filter); i++) {
+                    prev_blurred[i] = vsapi->propGetFrame(prev_props, "tcomb_blurred", i, NULL);
+                    cur_blurred[i] = vsapi->propGetFrame(cur_props, "tcomb_blurred", i, NULL);
+                    prev_blurred_views[i] = readView(prev_blurred[i], vsapi);
+                    cur_blurred_views[i] = readView(cur_blurred[i], vsapi);
+                }
+            }
+
+            msk1 = newLumaFrame(d, core, vsapi);
+            msk1_view = writeView(msk1, &d->filter, vsapi);
+        }
+
+        VSFrameRef *avg = NULL;
+
+        if (dup) {
+            // The average of two identical fields is the field itself.
+            if (!lowmem) {
+                const VSFrameRef *planes[3] = { cur, cur, cur };
+                const int plane_numbers[3] = { 0, 1, 2 };
+                avg = vsapi->newVideoFrame2(d->vi->format, d->vi->width, d->vi->height, planes, plane_numbers, NULL, core);
+            }
+
+            tcombStage2Duplicate(&d->filter, &cur_view, &msk1_view, NULL);
+        } else if (lowmem) {
+            // The blurs only live until msk1 is done.
+            VSFrameRef *scratch[4] = { NULL };
+            TCombFrame scratch_views[4];
+
+            for (int i = 0; i < 4 && tcombFilterProcessesLuma(&d->filter); i++) {
+                scratch[i] = newLumaFrame(d, core, vsapi);
+                scratch_views[i] = writeView(scratch[i], &d->filter, vsapi);
+            }
+
+            tcombStage2LowMem(&d->filter, &prev_view, &cur_view, &msk1_view, scratch_views);
+
+            for (int i = 0; i < 4; i++)
+                vsapi->freeFrame(scratch[i]);
+        } else {
+            avg = newPlanesFrame(d, cur, d->vi->width, d->vi->height, core, vsapi);
+            TCombFrame avg_view = writeView(avg, &d->filter, vsapi);
+
+            tcombStage2(&d->filter, &prev_view, &cur_view, prev_blurred_views, cur_blurred_views, &msk1_view, &avg_view);
+        }
+
+        if (tcombFilterProcessesLuma(&d->filter)) {
+            for (int i = 0; i < 6; i++) {
+                vsapi->freeFrame(prev_blurred[i]);
+                vsapi->freeFrame(cur_blurred[i]);
+            }
+
+            vsapi->propDeleteKey(props, "tcomb_blurred");
+
+            vsapi->propSetFrame(props, "tcomb_msk1", msk1, paReplace);
+            vsapi->freeFrame(msk1);
+        }
+
+        if (avg) {
+            vsapi->propSetFrame(props, "tcomb_avg", avg, paReplace);
+            vsapi->freeFrame(avg);
+        }
+
+        vsapi->freeFrame(prev);
+        vsapi->freeFrame(cur);
+
+        return dst;
+    }
+
+    return 0;
+}
+
+
+static const VSFrameRef *VS_CC tcombStage3GetFrame(int n, int activationReason, void **instanceData, void **frameData, VSFrameContext *frameCtx, VSCore *core, const VSAPI *vsapi) {
+    TCombData *d = (TCombData *) * instanceData;
+
+    if (activationReason == arInitial) {
+        for (int i = -8; i <= 0; i += 2) {
+            vsapi->requestFrameFilter(VSMAX(0, n - i), d->node, frameCtx);
+        }
+
+        // The averages get recomputed from the fields, which needs the one
+        // before the oldest.
+        if (d->filter.params.lowmem)
+            vsapi->requestFrameFilter(VSMAX(0, VSMIN(n, d->vi->numFrames - 1) - 2), d->node, frameCtx);
+    } else if (activationReason == arAllFramesReady) {
+        statsCount(d->stats, d->stage, n);
+
+        const VSFrameRef *src[5];
+        TCombFrame src_views[5];
+
+        for (int i = -8; i <= 0; i += 2) {
+            src[(i + 8) / 2] = vsapi->getFrameFilter(VSMAX(0, n - i), d->node, frameCtx);
+            src_views[(i + 8) / 2] = readView(src[(i + 8) / 2], vsapi);
+        }
+
+        VSFrameRef *dst = vsapi->copyFrame(src[4], core);
+        VSMap *props = vsapi->getFramePropsRW(dst);
+
+        VSFrameRef *omsk = newPlanesFrame(d, src[4], d->vi->width, d->vi->height, core, vsapi);
+        TCombFrame omsk_view = writeView(omsk, &d->filter, vsapi);
+
+        if (d->filter.params.lowmem) {
+            const VSFrameRef *cur[4], *prev[4];
+            TCombFrame cur_views[4], prev_views[4];
+
+            for (int i = 0; i < 4; i++) {
+                const int k = VSMIN(n + 6 - i * 2, d->vi->numFrames - 1);
+                cur[i] = vsapi->getFrameFilter(k, d->node, frameCtx);
+                prev[i] = vsapi->getFrameFilter(VSMAX(0, k - 2), d->node, frameCtx);
+                cur_views[i] = readView(cur[i], vsapi);
+                prev_views[i] = readView(prev[i], vsapi);
+            }
+
+            tcombStage3LowMem(&d->filter, src_views, cur_views, prev_views, &omsk_view);
+
+            for (int i = 0; i < 4; i++) {
+                vsapi->freeFrame(cur[i]);
+                vsapi->freeFrame(prev[i]);
+            }
+        } else {
+            const VSFrameRef *avg[4];
+            TCombFrame avg_views[4];
+
+            for (int i = 0; i < 4; i++) {
+                avg[i] = vsapi->propGetFrame(vsapi->getFramePropsRO(src[i + 1]), "tcomb_avg", 0, NULL);
+                avg_views[i] = readView(avg[i], vsapi);
+            }
+
+            tcombStage3(&d->filter, src_views, avg_views, &omsk_view);
+
+            for (int i = 0; i < 4; i++)
+                vsapi->freeFrame(avg[i]);
+        }
+
+        for (int i = 0; i < 5; i++)
+            vsapi->freeFrame(src[i]);
+
+        vsapi->propDeleteKey(props, "tcomb_avg");
+
+        vsapi->propSetFrame(props, "tcomb_omsk", omsk, paReplace);
+        vsapi->freeFrame(omsk);
+
+        return dst;
+    }
+
+    return 0;
+}
+
+
+static const VSFrameRef *VS_CC tcombStage4GetFrame(int n, int activationReason, void **instanceData, void **frameData, VSFrameContext *frameCtx, VSCore *core, const VSAPI *vsapi) {
+    TCombData *d = (TCombData *) * instanceData;
+
+    if (activationReason == arInitial) {
+        for (int i = -4; i <= 6; i += 2)
+            vsapi->requestFrameFilter(VSMIN(VSMAX(0, n + i), d->vi->numFrames - 1), d->node, frameCtx);
+    } else if (activationReason == arAllFramesReady) {
+        statsCount(d->stats, d->stage, n);
+
+        const VSFrameRef *src[6];
+
+        for (int i = -4; i <= 6; i += 2)
+            src[(i + 4) / 2] = vsapi->getFrameFilter(VSMIN(VSMAX(0, n + i), d->vi->numFrames - 1), d->node, frameCtx);
+
+        VSFrameRef *dst = vsapi->copyFrame(src[2], core);
+
+        int sc[2];
+        const VSFrameRef *omsk[5];
+        const VSFrameRef *msk1[2] = { 0 };
+        TCombFrame omsk_views[5];
+        TCombFrame msk1_views[2] = { { { NULL }, { 0 } }, { { NULL }, { 0 } } };
+
+        for (int i = 0; i < 5; i++) {
+            omsk[i] = vsapi->propGetFrame(vsapi->getFramePropsRO(src[i + 1]), "tcomb_omsk", 0, NULL);
+            omsk_views[i] = readView(omsk[i], vsapi);
+        }
+
+        for (int i = 0; i < 2; i++) {
+            const VSMap *src_props = vsapi->getFramePropsRO(src[i + 1]);
+            sc[i] = vsapi->propGetInt(src_props, "tcomb_sc", 0, NULL);
+            if (tcombFilterProcessesLuma(&d->filter)) {
+                msk1[i] = vsapi->propGetFrame(src_props, "tcomb_msk1", 0, NULL);
+                msk1_views[i] = readView(msk1[i], vsapi);
+            }
+        }
+
+        VSFrameRef *msk2 = newPlanesFrame(d, src[2], d->vi->width, d->vi->height, core, vsapi);
+        VSFrameRef *tmp = newPlanesFrame(d, src[2], d->vi->width, d->vi->height, core, vsapi);
+
+        const TCombFrame prev2_view = readView(src[0], vsapi);
+        const TCombFrame cur_view = readView(src[2], vsapi);
+        TCombFrame tmp_view = writeView(tmp, &d->filter, vsapi);
+        TCombFrame msk2_view = writeView(msk2, &d->filter, vsapi);
+
+        const VSFrameRef *pairs[4] = { NULL };
+        TCombFrame pair_views[4];
+        const int use_pairs = d->pairs && !sc[0] && !sc[1];
+
+        for (int i = 0; i < 4 && use_pairs; i++) {
+            pairs[i] = pairsGet(d, n - 2 + i * 2, &omsk_views[i], &omsk_views[i + 1], core, vsapi);
+            pair_views[i] = readView(pairs[i], vsapi);
+        }
+
+        tcombStage4(&d->filter, &prev2_view, &cur_view, sc, omsk_views, use_pairs ? pair_views : NULL, msk1_views, &tmp_view, &msk2_view);
+
+        vsapi->freeFrame(tmp);
+
+        for (int i = 0; i < 4; i++)
+            vsapi->freeFrame(pairs[i]);
+
+        if (d->mask_writer) {
+            int flags = 0;
+            if (sc[1])
+                flags |= TCombMaskSceneChange;
+            if (vsapi->propGetInt(vsapi->getFramePropsRO(src[2]), "tcomb_dup", 0, NULL))
+                flags |= TCombMaskDuplicate;
+
+            if (!tcombMaskWriterAdd(d->mask_writer, n, &msk2_view, flags, tcombFieldHash(&d->filter, &cur_view)))
+                vsapi->setFilterError("TComb: Out of memory.", frameCtx);
+        }
+
+        for (int i = 0; i < 5; i++)
+            vsapi->freeFrame(omsk[i]);
+
+        for (int i = 0; i < 2; i++)
+            vsapi->freeFrame(msk1[i]);
+
+        for (int i = 0; i < 6; i++)
+            vsapi->freeFrame(src[i]);
+
+        VSMap *props = vsapi->getFramePropsRW(dst);
+        vsapi->propSetFrame(props, "tcomb_msk2", msk2, paReplace);
+        vsapi->freeFrame(msk2);
+
+        vsapi->propDeleteKey(props, "tcomb_msk1");
+        vsapi->propDeleteKey(props, "tcomb_omsk");
+        vsapi->propDeleteKey(props, "tcomb_sc");
+
+        return dst;
+    }
+
+    return 0;
+}
+
+
+static const VSFrameRef *VS_CC tcombStage5GetFrame(int n, int activationReason, void **instanceData, void **frameData, VSFrameContext *frameCtx, VSCore *core, const VSAPI *vsapi) {
+    TCombData *d = (TCombData *) * instanceData;
+
+    if (activationReason == arInitial) {
+        for (int i = -4; i <= 4; i += 2)
+            vsapi->requestFrameFilter(VSMIN(VSMAX(0, n + i), d->vi->numFrames - 1), d->node, frameCtx);
+    } else if (activationReason == arAllFramesReady) {
+        statsCount(d->stats, d->stage, n);
+
+        const VSFrameRef *src[5];
+        TCombFrame src_views[5];
+
+        for (int i = -4; i <= 4; i += 2) {
+            src[(i + 4) / 2] = vsapi->getFrameFilter(VSMIN(VSMAX(0, n + i), d->vi->numFrames - 1), d->node, frameCtx);
+            src_views[(i + 4) / 2] = readView(src[(i + 4) / 2], vsapi);
+        }
+
+        if (d->mask_reader && tcombFieldHash(&d->filter, &src_views[2]) != tcombMaskReaderHash(d->mask_reader, n)) {
+            for (int i = 0; i < 5; i++)
+                vsapi->freeFrame(src[i]);
+
+            vsapi->setFilterError("TComb: The mask file was made from a different clip.", frameCtx);
+            return NULL;
+        }
+
+        // If all five fields are identical, every filtered value is equal to
+        // the original one and the output is field n.
+        int identical = !d->filter.params.map && !d->both;
+
+        for (int i = 1; i < 5 && identical; i++) {
+            const int k = VSMIN(VSMAX(0, n - 4 + i * 2), d->vi->numFrames - 1);
+            const int prev_k = VSMIN(VSMAX(0, n - 6 + i * 2), d->vi->numFrames - 1);
+
+            int dup;
+            if (d->mask_reader)
+                dup = !!(tcombMaskReaderFlags(d->mask_reader, k) & TCombMaskDuplicate);
+            else
+                dup = !!vsapi->propGetInt(vsapi->getFramePropsRO(src[i]), "tcomb_dup", 0, NULL);
+
+            identical = k == prev_k || (VSMAX(0, k - 2) == prev_k && dup);
+        }
+
+        if (identical) {
+            const VSFrameRef *planes[3] = { src[2], src[2], src[2] };
+            const int plane_numbers[3] = { 0, 1, 2 };
+            VSFrameRef *dst = vsapi->newVideoFrame2(d->vi->format, d->vi->width, d->vi->height, planes, plane_numbers, src[2], core);
+
+            for (int i = 0; i < 5; i++)
+                vsapi->freeFrame(src[i]);
+
+            VSMap *props = vsapi->getFramePropsRW(dst);
+            vsapi->propDeleteKey(props, "tcomb_msk2");
+            vsapi->propDeleteKey(props, "tcomb_dup");
+
+            setRecomputed(props, d->stats, vsapi);
+
+            return dst;
+        }
+
+        const VSFrameRef *msk2[3];
+        TCombFrame msk2_views[3];
+
+        for (int i = 0; i < 3; i++) {
+            if (d->mask_reader) {
+                VSFrameRef *decoded = newPlanesFrame(d, src[2], d->vi->width, d->vi->height, core, vsapi);
+                msk2_views[i] = writeView(decoded, &d->filter, vsapi);
+                msk2[i] = decoded;
+
+                if (!tcombMaskReaderDecode(d->mask_reader, VSMIN(n + i * 2, d->vi->numFrames - 1), &msk2_views[i])) {
+                    for (int j = 0; j <= i; j++)
+                        vsapi->freeFrame(msk2[j]);
+                    for (int j = 0; j < 5; j++)
+                        vsapi->freeFrame(src[j]);
+
+                    vsapi->setFilterError("TComb: The mask file is corrupt.", frameCtx);
+                    return NULL;
+                }
+            } else {
+                msk2[i] = vsapi->propGetFrame(vsapi->getFramePropsRO(src[i + 2]), "tcomb_msk2", 0, NULL);
+                msk2_views[i] = readView(msk2[i], vsapi);
+            }
+        }
+
+        // The planes the filter doesn't process are field n's own.
+        const VSFrameRef *planes[3] = { NULL };
+        const int plane_numbers[3] = { 0, 1, 2 };
+
+        for (int b = 0; b < d->vi->format->numPlanes && !d->filter.params.map; b++)
+            if (b < d->filter.start || b >= d->filter.stop)
+                planes[b] = src[2];
+
+        VSFrameRef *dst = vsapi->newVideoFrame2(d->vi->format, d->vi->width, d->vi->height, planes, plane_numbers, src[2], core);
+
+        VSFrameRef *map = NULL;
+        TCombFrame map_view = { { NULL }, { 0 } };
+        if (d->both) {
+            map = vsapi->newVideoFrame(d->vi->format, d->vi->width, d->vi->height, src[2], core);
+            map_view = writeView(map, NULL, vsapi);
+        }
+
+        VSFrameRef *min = newPlanesFrame(d, src[2], d->vi->width, d->vi->height, core, vsapi);
+        VSFrameRef *max = newPlanesFrame(d, src[2], d->vi->width, d->vi->height, core, vsapi);
+        // Every plane needs a border of at least two pixels, chroma too.
+        VSFrameRef *pad = newPlanesFrame(d, NULL, d->vi->width + (4 << d->vi->format->subSamplingW),
+                                         d->vi->height + (4 << d->vi->format->subSamplingH), core, vsapi);
+
+        TCombFrame dst_view = writeView(dst, &d->filter, vsapi);
+        TCombFrame min_view = writeView(min, &d->filter, vsapi);
+        TCombFrame max_view = writeView(max, &d->filter, vsapi);
+        TCombFrame pad_view = writeView(pad, &d->filter, vsapi);
+
+        tcombStage5(&d->filter, src_views, msk2_views, &dst_view, map ? &map_view : NULL, &min_view, &max_view, &pad_view);
+
+        if (d->filter.params.map) {
+            TCombFrame all_view = writeView(dst, NULL, vsapi);
+            tcombStage5Unprocessed(&d->filter, &src_views[2], &all_view);
+        }
+
+        vsapi->freeFrame(min);
+        vsapi->freeFrame(max);
+        vsapi->freeFrame(pad);
+
+        for (int i = 0; i < 3; i++)
+            vsapi->freeFrame(msk2[i]);
+
+        for (int i = 0; i < 5; i++)
+            vsapi->freeFrame(src[i]);
+
+        VSMap *props = vsapi->getFramePropsRW(dst);
+        vsapi->propDeleteKey(props, "tcomb_msk2");
+        vsapi->propDeleteKey(props, "tcomb_dup");
+
+        setRecomputed(props, d->stats, vsapi);
+
+        if (map) {
+            VSMap *map_props = vsapi->getFramePropsRW(map);
+            vsapi->propDeleteKey(map_props, "tcomb_msk2");
+            vsapi->propDeleteKey(map_props, "tcomb_dup");
+
+            setRecomputed(map_props, d->stats, vsapi);
+
+            vsapi->propSetFrame(props, "tcomb_map", map, paReplace);
+            vsapi->freeFrame(map);
+        }
+
+        return dst;
+    }
+
+    return 0;
+}
+
+
+// With both, returns either Stage 5's output or the map attached to it.
+static const VSFrameRef *VS_CC tcombSplitGetFrame(int n, int activationReason, void **instanceData, void **frameData, VSFrameContext *frameCtx, VSCore *core, const VSAPI *vsapi) {
+    TCombData *d = (TCombData *) * instanceData;
+
+    if (activationReason == arInitial) {
+        vsapi->requestFrameFilter(n, d->node, frameCtx);
+    } else if (activationReason == arAllFramesReady) {
+        const VSFrameRef *src = vsapi->getFrameFilter(n, d->node, frameCtx);
+
+        if (d->split == SplitMap) {
+            const VSFrameRef *map = vsapi->propGetFrame(vsapi->getFramePropsRO(src), "tcomb_map", 0, NULL);
+            vsapi->freeFrame(src);
+            return map;
+        }
+
+        VSFrameRef *dst = vsapi->copyFrame(src, core);
+        vsapi->freeFrame(src);
+
+        vsapi->propDeleteKey(vsapi->getFramePropsRW(dst), "tcomb_map");
+
+        return dst;
+    }
+
+    return 0;
+}
+
+
+// Replaces Stage 5 and everything after it with analyze. The frames are
+// returned unchanged, with the number of pixels set in msk2 of each field,
+// i.e. the pixels the filter would change.
+static const VSFrameRef *VS_CC tcombAnalyzeGetFrame(int n, int activationReason, void **instanceData, void **frameData, VSFrameContext *frameCtx, VSCore *core, const VSAPI *vsapi) {
+    TCombData *d = (TCombData *) * instanceData;
+
+    // Field n * 2 + i is examined when examined[i] is set.
+    const int examined[2] = { n * 2 % d->stride == 0, (n * 2 + 1) % d->stride == 0 };
+
+    if (activationReason == arInitial) {
+        vsapi->requestFrameFilter(n, d->clip, frameCtx);
+        for (int i = 0; i < 2; i++)
+            if (examined[i])
+                vsapi->requestFrameFilter(n * 2 + i, d->node, frameCtx);
+    } else if (activationReason == arAllFramesReady) {
+        statsCount(d->stats, d->stage, n);
+
+        const VSFrameRef *src = vsapi->getFrameFilter(n, d->clip, frameCtx);
+        VSFrameRef *dst = vsapi->copyFrame(src, core);
+        vsapi->freeFrame(src);
+
+        VSMap *props = vsapi->getFramePropsRW(dst);
+
+        if (examined[0] || examined[1]) {
+            int64_t pixels = 0;
+            for (int b = d->filter.start; b < d->filter.stop; b++)
+                pixels += (int64_t)d->filter.width[b] * d->filter.height[b];
+
+            int64_t candidates[3][2];
+            double occupancy[2];
+
+            for (int i = 0; i < 2; i++) {
+                if (!examined[i]) {
+                    for (int b = 0; b < 3; b++)
+                        candidates[b][i] = -1;
+                    occupancy[i] = -1.0;
+                    continue;
+                }
+
+                const VSFrameRef *field = vsapi->getFrameFilter(n * 2 + i, d->node, frameCtx);
+                const VSFrameRef *msk2 = vsapi->propGetFrame(vsapi->getFramePropsRO(field), "tcomb_msk2", 0, NULL);
+                const TCombFrame msk2_view = readView(msk2, vsapi);
+
+                int64_t counts[3];
+                tcombMaskCount(&d->filter, &msk2_view, counts);
+
+                int64_t total = 0;
+                for (int b = 0; b < 3; b++) {
+                    candidates[b][i] = counts[b];
+                    total += counts[b];
+                }
+                occupancy[i] = (double)total / pixels;
+
+                vsapi->freeFrame(msk2);
+                vsapi->freeFrame(field);
+            }
+
+            static const char *keys[3] = { "TCombCandidatesY", "TCombCandidatesU", "TCombCandidatesV" };
+
+            vsapi->propSetFloatArray(props, "TCombMaskOccupancy", occupancy, 2);
+            for (int b = d->filter.start; b < d->filter.stop; b++)
+                vsapi->propSetIntArray(props, keys[b], candidates[b], 2);
+        }
+
+        setRecomputed(props, d->stats, vsapi);
+
+        return dst;
+    }
+
+    return 0;
+}
+
+
+static void VS_CC tcombFree(void *instanceData, VSCore *core, const VSAPI *vsapi) {
+    TCombData *d = (TCombData *)instanceData;
+
+    vsapi->freeNode(d->node);
+    vsapi->freeNode(d->clip);
+
+    if (d->mask_writer) {
+        // Nothing is written if the clip wasn't processed at all, e.g.
+        // because the script failed.
+        if (tcombMaskWriterCount(d->mask_writer) > 0) {
+            const char *error = tcombMaskWriterSave(d->mask_writer, d->mask_path);
+            if (error)
+                vsapi->logMessage(mtWarning, error);
+        }
+
+        tcombMaskWriterFree(d->mask_writer);
+        free(d->mask_path);
+    }
+
+    tcombMaskReaderClose(d->mask_reader);
+
+    pairsFree(d->pairs, vsapi);
+
+    if (__atomic_sub_fetch(&d->stats->refcount, 1, __ATOMIC_ACQ_REL) == 0) {
+        statsLog(d->stats, vsapi);
+
+        free(d->stats->computed[0]);
+        free(d->stats);
+    }
+
+    free(d);
+}
+
+
+// A size of 0 leaves the cache to VapourSynth's own sizing.
+static int invokeCache(VSNodeRef **node, int size, VSMap *out, VSPlugin *stdPlugin, const VSAPI *vsapi) {
+    VSMap *args = vsapi->createMap();
+    vsapi->propSetNode(args, "clip", *node, paReplace);
+    vsapi->freeNode(*node);
+    if (size > 0) {
+        vsapi->propSetInt(args, "size", size, paReplace);
+        vsapi->propSetInt(args, "fixed", 1, paReplace);
+    }
+    VSMap *ret = vsapi->invoke(stdPlugin, "Cache", args);
+    vsapi->freeMap(args);
+    if (!vsapi->getError(ret)) {
+        *node = vsapi->propGetNode(ret, "clip", 0, NULL);
+        vsapi->freeMap(ret);
+        return 1;
+    } else {
+        vsapi->setError(out, vsapi->getError(ret));
+        vsapi->freeMap(ret);
+        return 0;
+    }
+}
+
+
+static int invokeSeparateFields(VSNodeRef **node, VSMap *out, VSPlugin *stdPlugin, const VSAPI *vsapi) {
+    VSMap *args = vsapi->createMap();
+    vsapi->propSetNode(args, "clip", *node, paReplace);
+    vsapi->freeNode(*node);
+    vsapi->propSetInt(args, "tff", 1, paReplace);
+    VSMap *ret = vsapi->invoke(stdPlugin, "SeparateFields", args);
+    vsapi->freeMap(args);
+    if (!vsapi->getError(ret)) {
+        *node = vsapi->propGetNode(ret, "clip", 0, NULL);
+        vsapi->freeMap(ret);
+        return 1;
+    } else {
+        vsapi->setError(out, vsapi->getError(ret));
+        vsapi->freeMap(ret);
+        return 0;
+    }
+}
+
+
+static int invokeDoubleWeave(VSNodeRef **node, VSMap *out, VSPlugin *stdPlugin, const VSAPI *vsapi) {
+    VSMap *args = vsapi->createMap();
+    vsapi->propSetNode(args, "clip", *node, paReplace);
+    vsapi->freeNode(*node);
+    vsapi->propSetInt(args, "tff", 1, paReplace);
+    VSMap *ret = vsapi->invoke(stdPlugin, "DoubleWeave", args);
+    vsapi->freeMap(args);
+    if (!vsapi->getError(ret)) {
+        *node = vsapi->propGetNode(ret, "clip", 0, NULL);
+        vsapi->freeMap(ret);
+        return 1;
+    } else {
+        vsapi->setError(out, vsapi->getError(ret));
+        vsapi->freeMap(ret);
+        return 0;
+    }
+}
+
+
+static int invokeSelectEvery(VSNodeRef **node, VSMap *out, VSPlugin *stdPlugin, const VSAPI *vsapi) {
+    VSMap *args = vsapi->createMap();
+    vsapi->propSetNode(args, "clip", *node, paReplace);
+    vsapi->freeNode(*node);
+    vsapi->propSetInt(args, "cycle", 2, paReplace);
+    vsapi->propSetInt(args, "offsets", 0, paReplace);
+    VSMap *ret = vsapi->invoke(stdPlugin, "SelectEvery", args);
+    vsapi->freeMap(args);
+    if (!vsapi->getError(ret)) {
+        *node = vsapi->propGetNode(ret, "clip", 0, NULL);
+        vsapi->freeMap(ret);
+        return 1;
+    } else {
+        vsapi->setError(out, vsapi->getError(ret));
+        vsapi->freeMap(ret);
+        return 0;
+    }
+}
+
+
+static int invokeTrim(VSNodeRef **node, int first, int last, VSMap *out, VSPlugin *stdPlugin, const VSAPI *vsapi) {
+    VSMap *args = vsapi->createMap();
+    vsapi->propSetNode(args, "clip", *node, paReplace);
+    vsapi->freeNode(*node);
+    vsapi->propSetInt(args, "first", first, paReplace);
+    vsapi->propSetInt(args, "last", last, paReplace);
+    VSMap *ret = vsapi->invoke(stdPlugin, "Trim", args);
+    vsapi->freeMap(args);
+    if (!vsapi->getError(ret)) {
+        *node = vsapi->propGetNode(ret, "clip", 0, NULL);
+        vsapi->freeMap(ret);
+        return 1;
+    } else {
+        vsapi->setError(out, vsapi->getError(ret));
+        vsapi->freeMap(ret);
+        return 0;
+    }
+}
+
+
+// Turns Stage 5's fields back into frames.
+static int weaveFields(VSNodeRef **node, int cache_size, VSMap *out, VSPlugin *stdPlugin, const VSAPI *vsapi) {
+    if (!invokeDoubleWeave(node, out, stdPlugin, vsapi))
+        return 0;
+
+    if (!invokeCache(node, cache_size, out, stdPlugin, vsapi))
+        return 0;
+
+    return invokeSelectEvery(node, out, stdPlugin, vsapi);
+}
+
+
+enum TCombCaches {
+    CacheFields = 0,
+    CacheStage1,
+    CacheStage2,
+    CacheStage3,
+    CacheStage4,
+    CacheStage5,
+    CacheWoven,
+    NumCaches
+};
+
+
+// Measures the black bars of the clip from frames spread over its length.
+// Each border is only as wide as the narrowest one found, so that dark
+// scenes can't make it too wide. Returns 0 if a frame couldn't be fetched.
+static int findBorders(VSNodeRef *node, const VSVideoInfo *vi, TCombParams *params, char *error, int error_size, const VSAPI *vsapi) {
+    const int samples = VSMIN(vi->numFrames, 16);
+    int found = 0;
+
+    for (int i = 0; i < samples; i++) {
+        const int n = (int)((int64_t)vi->numFrames * (2 * i + 1) / (2 * samples));
+
+        const VSFrameRef *frame = vsapi->getFrame(n, node, error, error_size);
+        if (!frame)
+            return 0;
+
+        int left, top, right, bottom;
+        if (tcombFindBorders(vsapi->getReadPtr(frame, 0), vsapi->getStride(frame, 0), vi->width, vi->height, &left, &top, &right, &bottom)) {
+            if (!found) {
+                params->left = left;
+                params->top = top;
+                params->right = right;
+                params->bottom = bottom;
+                found = 1;
+            } else {
+                params->left = VSMIN(params->left, left);
+                params->top = VSMIN(params->top, top);
+                params->right = VSMIN(params->right, right);
+                params->bottom = VSMIN(params->bottom, bottom);
+            }
+        }
+
+        vsapi->freeFrame(frame);
+    }
+
+    return 1;
+}
+
+
+// With a budget, each cache only holds the window of fields that the
+// following stage reads for one field, plus the fields the other threads are
+// working on. If the caches would need more than max_memory bytes, they are
+// made smaller and the stages recompute what was dropped. Without one
+// (max_memory 0) the sizes are 0 and VapourSynth sizes the caches itself.
+// Returns the bytes of intermediates that one field keeps alive, and the
+// bytes all the caches and Stage 4's pairs hold in total (0 without a
+// budget). The total is still above max_memory if the caches can't shrink
+// enough.
+static void cacheSizes(int sizes[NumCaches], int64_t *field_bytes, int64_t *total_bytes, const TCombData *d, int analyzing, int num_threads, int64_t max_memory) {
+    // The span of fields read by Stage 1 (n - 2 ... n + 2), Stage 2 (n - 2 ... n),
+    // Stage 3 (n ... n + 8), Stage 4 (n - 4 ... n + 6), Stage 5 (n - 4 ... n + 4),
+    // the two fields woven by DoubleWeave (only cached with both, where
+    // the two outputs read them), and the single woven frame read by SelectEvery.
+    int windows[NumCaches] = { 5, 3, 9, 11, 9, 2, 1 };
+
+    // With lowmem Stage 3 reads the fields before its window again, to
+    // average them.
+    if (d->filter.params.lowmem)
+        windows[CacheStage2] = 11;
+
+    // With a mask file Stage 5 reads the fields directly and the other
+    // stages don't exist.
+    int reading = d->mask_reader != NULL;
+    if (reading)
+        windows[CacheFields] = 9;
+
+    // With analyze the frames aren't rebuilt, and only the two fields of
+    // each frame are read after Stage 4.
+    if (analyzing)
+        windows[CacheStage4] = 2;
+
+    // The intermediates only hold the planes that are processed.
+    int64_t field_size = 0, luma_size = 0, planes_size = 0;
+    for (int i = 0; i < d->vi->format->numPlanes; i++) {
+        int w = d->vi->width >> (i ? d->vi->format->subSamplingW : 0);
+        int h = d->vi->height >> (i ? d->vi->format->subSamplingH : 0);
+        int64_t size = (int64_t)((w + 31) & ~31) * h;
+
+        field_size += size;
+        if (i == 0)
+            luma_size = size;
+        if (i >= d->filter.start && i < d->filter.stop)
+            planes_size += size;
+    }
+
+    // The memory each cached frame keeps alive on its own. The stages
+    // return copies of their input, which share its planes, and only the
+    // intermediates they attach cost extra. So does the output, except
+    // for the planes it shares with the fields.
+    int luma = tcombFilterProcessesLuma(&d->filter);
+    int blurs = tcombBlurCount(&d->filter);
+    int64_t costs[NumCaches] = {
+        field_size,                                             // field
+        luma ? blurs * luma_size : 0,                           // tcomb_blurred
+        (luma ? luma_size : 0) + planes_size,                   // tcomb_msk1, tcomb_avg
+        planes_size,                                            // tcomb_omsk
+        planes_size,                                            // tcomb_msk2
+        0,                                                      // output field
+        2 * (d->filter.params.map ? field_size : planes_size)   // woven frame
+    };
+
+    // Each output field carries a map, and there are two woven frames.
+    if (d->both) {
+        costs[CacheStage5] = planes_size + field_size;
+        costs[CacheWoven] = 2 * (planes_size + field_size);
+    }
+
+    // Without the blurs and the averages only msk1 is left.
+    if (d->filter.params.lowmem) {
+        costs[CacheStage1] = 0;
+        costs[CacheStage2] = luma ? luma_size : 0;
+    }
+
+    if (reading)
+        costs[CacheStage1] = costs[CacheStage2] = costs[CacheStage3] = costs[CacheStage4] = 0;
+    if (analyzing)
+        costs[CacheWoven] = 0;
+
+    // Stage 3 asks for n + 8 first and the requests of the stages after it
+    // overlap, so the fields don't arrive in order. Two extra fields cover
+    // that; each thread adds one frame, i.e. two fields.
+    int64_t total = 0;
+    for (int i = 0; i < NumCaches; i++) {
+        sizes[i] = windows[i] + (i == CacheWoven ? num_threads : 2 + 2 * num_threads);
+        total += sizes[i] * costs[i];
+    }
+
+    *field_bytes = 0;
+    for (int i = CacheStage1; i <= CacheStage4; i++)
+        *field_bytes += costs[i];
+
+    // Stage 4 keeps its pairs of omsk on the side, one luma plane each.
+    if (luma && !reading)
+        total += pairSlots(num_threads) * luma_size;
+
+    // Over budget, shrink the caches one at a time. The blurred fields take
+    // the most memory and are the cheapest to compute again. A miss in the
+    // caches after Stage 3 and Stage 4 brings a cascade of recomputations of
+    // the earlier stages, so those are shrunk last.
+    static const int order[NumCaches] = { CacheStage1, CacheFields, CacheWoven, CacheStage5, CacheStage2, CacheStage4, CacheStage3 };
+
+    for (int i = 0; i < NumCaches && max_memory > 0 && total > max_memory; i++) {
+        int c = order[i];
+        if (costs[c] == 0)
+            continue;
+
+        int64_t excess = total - max_memory;
+        int shrink = (int)VSMIN(sizes[c] - 1, (excess + costs[c] - 1) / costs[c]);
+        sizes[c] -= shrink;
+        total -= shrink * costs[c];
+    }
+
+    *total_bytes = total;
+
+    if (max_memory <= 0) {
+        for (int i = 0; i < NumCaches; i++)
+            sizes[i] = 0;
+        *total_bytes = 0;
+    }
+}
+
+
+static void VS_CC tcombCreate(const VSMap *in, VSMap *out, void *userData, VSCore *core, const VSAPI *vsapi) {
+    TCombData d;
+    TCombData *data;
+    TCombParams params;
+    int err;
+
+    tcombParamsDefault(&params);
+
+    params.mode = vsapi->propGetInt(in, "mode", 0, &err);
+    if (err)
+        params.mode = LumaAndChroma;
+
+    params.fthreshl = vsapi->propGetInt(in, "fthreshl", 0, &err);
+    if (err)
+        params.fthreshl = 4;
+
+    params.fthreshc = vsapi->propGetInt(in, "fthreshc", 0, &err);
+    if (err)
+        params.fthreshc = 5;
+
+    params.othreshl = vsapi->propGetInt(in, "othreshl", 0, &err);
+    if (err)
+        params.othreshl = 5;
+
+    params.othreshc = vsapi->propGetInt(in, "othreshc", 0, &err);
+    if (err)
+        params.othreshc = 6;
+
+    params.map = !!vsapi->propGetInt(in, "map", 0, &err);
+
+    int both = !!vsapi->propGetInt(in, "both", 0, &err);
+
+    if (both && params.map) {
+        vsapi->setError(out, "TComb: map and both can't be used together.");
+        return;
+    }
+
+    params.scthresh = vsapi->propGetFloat(in, "scthresh", 0, &err);
+    if (err)
+        params.scthresh = 12.0;
+
+    params.preset = vsapi->propGetInt(in, "preset", 0, &err);
+
+    int crop_given = 0;
+
+    params.left = vsapi->propGetInt(in, "left", 0, &err);
+    crop_given |= !err;
+
+    params.top = vsapi->propGetInt(in, "top", 0, &err);
+    crop_given |= !err;
+
+    params.right = vsapi->propGetInt(in, "right", 0, &err);
+    crop_given |= !err;
+
+    params.bottom = vsapi->propGetInt(in, "bottom", 0, &err);
+    crop_given |= !err;
+
+    int autocrop = !!vsapi->propGetInt(in, "autocrop", 0, &err);
+
+    if (autocrop && crop_given) {
+        vsapi->setError(out, "TComb: autocrop can't be used with left, top, right, or bottom.");
+        return;
+    }
+
+
+    int64_t max_memory_mb = vsapi->propGetInt(in, "max_memory_mb", 0, &err);
+
+    if (max_memory_mb < 0) {
+        vsapi->setError(out, "TComb: max_memory_mb must not be negative.");
+        return;
+    }
+
+    params.lowmem = !!vsapi->propGetInt(in, "lowmem", 0, &err);
+
+    const char *write_masks = vsapi->propGetData(in, "write_masks", 0, &err);
+    if (err)
+        write_masks = NULL;
+
+    const char *read_masks = vsapi->propGetData(in, "read_masks", 0, &err);
+    if (err)
+        read_masks = NULL;
+
+    if (write_masks && read_masks) {
+        vsapi->setError(out, "TComb: write_masks and read_masks can't be used at the same time.");
+        return;
+    }
+
+    int analyze = !!vsapi->propGetInt(in, "analyze", 0, &err);
+
+    int stride = vsapi->propGetInt(in, "stride", 0, &err);
+    if (err)
+        stride = 1;
+
+    if (stride < 1) {
+        vsapi->setError(out, "TComb: stride must be at least 1.");
+        return;
+    }
+
+    if (analyze && read_masks) {
+        vsapi->setError(out, "TComb: analyze can't be used with read_masks.");
+        return;
+    }
+
+    if (analyze && both) {
+        vsapi->setError(out, "TComb: analyze can't be used with both.");
+        return;
+    }
+
+    int first_frame = vsapi->propGetInt(in, "first_frame", 0, &err);
+
+    int last_frame = vsapi->propGetInt(in, "last_frame", 0, &err);
+    if (err)
+        last_frame = -1;
+
+
+    const char *error = tcombParamsCheck(&params);
+    if (error) {
+        vsapi->setError(out, error);
+        return;
+    }
+
+    d.node = vsapi->propGetNode(in, "clip", 0, 0);
+    d.vi = vsapi->getVideoInfo(d.node);
+
+    if (!isConstantFormat(d.vi) ||
+        (d.vi->format->colorFamily != cmGray && d.vi->format->colorFamily != cmYUV) ||
+        d.vi->format->sampleType != stInteger ||
+        d.vi->format->bitsPerSample != 8) {
+        vsapi->setError(out, "TComb: Input must be 8 bit Gray or YUV with constant format and dimensions.");
+        vsapi->freeNode(d.node);
+        return;
+    }
+
+    if (d.vi->format->colorFamily == cmGray && params.mode > LumaOnly) {
+        vsapi->setError(out, "TComb: Mode must be 0 when input is Gray.");
+        vsapi->freeNode(d.node);
+        return;
+    }
+
+    if (last_frame < 0)
+        last_frame = d.vi->numFrames - 1;
+
+    if (first_frame < 0 || first_frame > last_frame || last_frame >= d.vi->numFrames) {
+        vsapi->setError(out, "TComb: first_frame and last_frame must be frames of the clip, with first_frame not after last_frame.");
+        vsapi->freeNode(d.node);
+        return;
+    }
+
+    // Only the output is cut. The stages still see the whole clip, so the
+    // fields around the range are read the same way as in a full run, and
+    // only those that the range depends on get processed.
+    int trim = first_frame > 0 || last_frame < d.vi->numFrames - 1;
+
+    // The mask file has to hold every field.
+    if (trim && write_masks) {
+        vsapi->setError(out, "TComb: write_masks can't be used with a range of frames.");
+        vsapi->freeNode(d.node);
+        return;
+    }
+
+    if (autocrop) {
+        char frame_error[512];
+        char message[600];
+
+        if (!findBorders(d.node, d.vi, &params, frame_error, sizeof(frame_error), vsapi)) {
+            snprintf(message, sizeof(message), "TComb: autocrop couldn't get a frame: %s", frame_error);
+            vsapi->setError(out, message);
+            vsapi->freeNode(d.node);
+            return;
+        }
+
+        snprintf(message, sizeof(message), "TComb: autocrop found borders of %d, %d, %d, %d pixels (left, top, right, bottom).",
+                 params.left, params.top, params.right, params.bottom);
+        vsapi->logMessage(mtDebug, message);
+    }
+
+    // The arguments count the rows of frames, the filter those of fields.
+    if (params.top > 0)
+        params.top /= 2;
+    if (params.bottom > 0)
+        params.bottom /= 2;
+
+    VSPlugin *stdPlugin = vsapi->getPluginById("com.vapoursynth.std", core);
+
+    if (!invokeSeparateFields(&d.node, out, stdPlugin, vsapi))
+        return;
+
+    // It's rather different after SeparateFields.
+    d.vi = vsapi->getVideoInfo(d.node);
+
+    TCombFormat format;
+    format.width = d.vi->width;
+    format.height = d.vi->height;
+    format.numPlanes = d.vi->format->numPlanes;
+    format.subSamplingW = d.vi->format->subSamplingW;
+    format.subSamplingH = d.vi->format->subSamplingH;
+
+    error = tcombFilterInit(&d.filter, &params, &format);
+    if (error) {
+        vsapi->setError(out, error);
+        vsapi->freeNode(d.node);
+        return;
+    }
+
+    d.gray = vsapi->getFormatPreset(pfGray8, core);
+
+    d.pairs = NULL;
+    d.mask_writer = NULL;
+    d.mask_path = NULL;
+    d.mask_reader = NULL;
+
+    d.clip = NULL;
+    d.stride = stride;
+
+    d.both = both;
+    d.split = 0;
+
+    if (read_masks) {
+        char message[1024];
+        d.mask_reader = tcombMaskReaderOpen(read_masks, &d.filter, d.vi->numFrames, message, sizeof(message));
+        if (!d.mask_reader) {
+            vsapi->setError(out, message);
+            vsapi->freeNode(d.node);
+            return;
+        }
+    }
+
+    // Handed to Stage 4.
+    TCombMaskWriter *mask_writer = NULL;
+    if (write_masks) {
+        mask_writer = tcombMaskWriterCreate(&d.filter, d.vi->numFrames);
+        if (!mask_writer) {
+            vsapi->setError(out, "TComb: Out of memory.");
+            vsapi->freeNode(d.node);
+            return;
+        }
+    }
+
+    int cache_sizes[NumCaches];
+    int64_t field_bytes, total_bytes;
+    cacheSizes(cache_sizes, &field_bytes, &total_bytes, &d, analyze, vsapi->getCoreInfo(core)->numThreads, max_memory_mb * 1024 * 1024);
+
+    if (max_memory_mb > 0 && total_bytes > max_memory_mb * 1024 * 1024) {
+        char message[200];
+        snprintf(message, sizeof(message), "TComb: max_memory_mb must be at least %" PRId64 " for this clip and number of threads.",
+                 (total_bytes + 1024 * 1024 - 1) / (1024 * 1024));
+        vsapi->setError(out, message);
+        tcombMaskReaderClose(d.mask_reader);
+        tcombMaskWriterFree(mask_writer);
+        vsapi->freeNode(d.node);
+        return;
+    }
+
+    {
+        char message[200];
+        if (max_memory_mb > 0)
+            snprintf(message, sizeof(message), "TComb: the intermediates take %" PRId64 " bytes per field, the caches up to %" PRId64 " bytes.",
+                     field_bytes, total_bytes);
+        else
+            snprintf(message, sizeof(message), "TComb: the intermediates take %" PRId64 " bytes per field.", field_bytes);
+        vsapi->logMessage(mtDebug, message);
+    }
+
+    if (!invokeCache(&d.node, cache_sizes[CacheFields], out, stdPlugin, vsapi)) {
+        tcombMaskReaderClose(d.mask_reader);
+        tcombMaskWriterFree(mask_writer);
+        return;
+    }
+
+    d.stats = malloc(sizeof(TCombStats));
+    d.stats->refcount = 0;
+    d.stats->numFields = d.vi->numFrames;
+    d.stats->computed[0] = calloc(5 * (size_t)d.vi->numFrames, sizeof(uint32_t));
+    for (int s = 0; s < 5; s++) {
+        d.stats->computed[s] = d.stats->computed[0] + s * (size_t)d.vi->numFrames;
+        d.stats->recomputed[s] = 0;
+    }
+    
+    if (!d.mask_reader) {
+        d.stage = 0;
+        d.stats->refcount++;
+        data = malloc(sizeof(d));
+        *data = d;
+        vsapi->createFilter(in, out, "TCombStage1", tcombInit, tcombStage1GetFrame, tcombFree, fmParallel, 0, data, core);
+        d.node = vsapi->propGetNode(out, "clip", 0, NULL);
+        if (!invokeCache(&d.node, cache_sizes[CacheStage1], out, stdPlugin, vsapi))
+            return;
+        vsapi->clearMap(out);
+
+        d.stage = 1;
+        d.stats->refcount++;
+        data = malloc(sizeof(d));
+        *data = d;
+        vsapi->createFilter(in, out, "TCombStage2", tcombInit, tcombStage2GetFrame, tcombFree, fmParallel, 0, data, core);
+        d.node = vsapi->propGetNode(out, "clip", 0, NULL);
+        if (!invokeCache(&d.node, cache_sizes[CacheStage2], out, stdPlugin, vsapi))
+            return;
+        vsapi->clearMap(out);
+
+        d.stage = 2;
+        d.stats->refcount++;
+        data = malloc(sizeof(d));
+        *data = d;
+        vsapi->createFilter(in, out, "TCombStage3", tcombInit, tcombStage3GetFrame, tcombFree, fmParallel, 0, data, core);
+        d.node = vsapi->propGetNode(out, "clip", 0, NULL);
+        if (!invokeCache(&d.node, cache_sizes[CacheStage3], out, stdPlugin, vsapi))
+            return;
+        vsapi->clearMap(out);
+
+        d.stage = 3;
+        d.stats->refcount++;
+        data = malloc(sizeof(d));
+        *data = d;
+        if (tcombFilterProcessesLuma(&d.filter))
+            data->pairs = pairsCreate(pairSlots(vsapi->getCoreInfo(core)->numThreads));
+        if (write_masks) {
+            data->mask_writer = mask_writer;
+            data->mask_path = malloc(strlen(write_masks) + 1);
+            strcpy(data->mask_path, write_masks);
+        }
+        vsapi->createFilter(in, out, "TCombStage4", tcombInit, tcombStage4GetFrame, tcombFree, fmParallel, 0, data, core);
+        d.node = vsapi->propGetNode(out, "clip", 0, NULL);
+        if (!invokeCache(&d.node, cache_sizes[CacheStage4], out, stdPlugin, vsapi))
+            return;
+        vsapi->clearMap(out);
+    }
+
+    d.stage = 4;
+    d.stats->refcount++;
+    data = malloc(sizeof(d));
+    *data = d;
+
+    if (analyze) {
+        data->clip = vsapi->propGetNode(in, "clip", 0, NULL);
+        data->vi = vsapi->getVideoInfo(data->clip);
+        vsapi->createFilter(in, out, "TComb", tcombInit, tcombAnalyzeGetFrame, tcombFree, fmParallel, 0, data, core);
+
+        if (trim) {
+            d.node = vsapi->propGetNode(out, "clip", 0, NULL);
+            vsapi->clearMap(out);
+
+            if (!invokeTrim(&d.node, first_frame, last_frame, out, stdPlugin, vsapi))
+                return;
+
+            vsapi->propSetNode(out, "clip", d.node, paReplace);
+            vsapi->freeNode(d.node);
+        }
+
+        return;
+    }
+
+    vsapi->createFilter(in, out, "TComb", tcombInit, tcombStage5GetFrame, tcombFree, fmParallel, 0, data, core);
+    d.node = vsapi->propGetNode(out, "clip", 0, NULL);
+
+    if (!d.both) {
+        if (!weaveFields(&d.node, cache_sizes[CacheWoven], out, stdPlugin, vsapi))
+            return;
+
+        if (trim && !invokeTrim(&d.node, first_frame, last_frame, out, stdPlugin, vsapi))
+            return;
+
+        vsapi->propSetNode(out, "clip", d.node, paReplace);
+        vsapi->freeNode(d.node);
+
+        return;
+    }
+
+    // Both outputs read the fields from one cache, so that Stage 5 only
+    // runs once per field.
+    if (!invokeCache(&d.node, cache_sizes[CacheStage5], out, stdPlugin, vsapi))
+        return;
+    vsapi->clearMap(out);
+
+    // These only hold a reference to the node and the stats.
+    d.mask_reader = NULL;
+
+    VSNodeRef *outputs[2];
+
+    for (int i = 0; i < 2; i++) {
+        d.split = i == 0 ? SplitFiltered : SplitMap;
+        d.stats->refcount++;
+        data = malloc(sizeof(d));
+        *data = d;
+        data->node = vsapi->cloneNodeRef(d.node);
+        vsapi->createFilter(in, out, "TCombSplit", tcombInit, tcombSplitGetFrame, tcombFree, fmParallel, 0, data, core);
+        outputs[i] = vsapi->propGetNode(out, "clip", 0, NULL);
+        vsapi->clearMap(out);
+
+        if (!weaveFields(&outputs[i], cache_sizes[CacheWoven], out, stdPlugin, vsapi) ||
+            (trim && !invokeTrim(&outputs[i], first_frame, last_frame, out, stdPlugin, vsapi))) {
+            if (i == 1)
+                vsapi->freeNode(outputs[0]);
+            vsapi->freeNode(d.node);
+            return;
+        }
+    }
+
+    vsapi->freeNode(d.node);
+
+    vsapi->propSetNode(out, "clip", outputs[0], paReplace);
+    vsapi->propSetNode(out, "clip", outputs[1], paAppend);
+    vsapi->freeNode(outputs[0]);
+    vsapi->freeNode(outputs[1]);
+
+    return;
+}
+
+
+VS_EXTERNAL_API(void) VapourSynthPluginInit(VSConfigPlugin configFunc, VSRegisterFunction registerFunc, VSPlugin *plugin) {
+    configFunc("com.nodame.tcomb", "tcomb", "Dotcrawl and rainbow remover", VAPOURSYNTH_API_VERSION, 1, plugin);
+    registerFunc("TComb",
+                 "clip:clip;"
+                 "mode:int:opt;"
+                 "fthreshl:int:opt;"
+                 "fthreshc:int:opt;"
+                 "othreshl:int:opt;"
+                 "othreshc:int:opt;"
+                 "map:int:opt;"
+                 "scthresh:float:opt;"
+                 "preset:int:opt;"
+                 "left:int:opt;"
+                 "top:int:opt;"
+                 "right:int:opt;"
+                 "bottom:int:opt;"
+                 "autocrop:int:opt;"
+                 "max_memory_mb:int:opt;"
+                 "lowmem:int:opt;"
+                 "write_masks:data:opt;"
+                 "read_masks:data:opt;"
+                 "analyze:int:opt;"
+                 "stride:int:opt;"
+                 "first_frame:int:opt;"
+                 "last_frame:int:opt;"
+                 "both:int:opt;",
+                 tcombCreate, 0, plugin);
+}
@@ -0,0 +1,612 @@
+/*
+ **   tcomb-bench: times the stages that read five fields at once.
+ **
+ **   Copyright (C) 2005-2006 Kevin Stone
+ **
+ **   VapourSynth port by dubhater
+ **
+ **   This program is free software; you can redistribute it and/or modify
+ **   it under the terms of the GNU General Public License as published by
+ **   the Free Software Foundation; either version 2 of the License, or
+ **   (at your option) any later version.
+ **
+ **   This program is distributed in the hope that it will be useful,
+ **   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ **   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ **   GNU General Public License for more details.
+ **
+ **   You should have received a copy of the GNU General Public License
+ **   along with this program; if not, write to the Free Software
+ **   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(TCOMB_X86)
+#include <emmintrin.h>
+#endif
+
+#include "tcomb_core.h"
+
+
+// Stage 3's checkOscillation5 reads five fields of the same parity, and
+// Stage 5's buildFinalFrame reads the same five fields, three masks and
+// the min and max planes. Both are timed with three layouts of that window:
+//
+// planar: one plane per field and per mask, each starting at the same
+//         offset within a page, which is what separate large allocations
+//         get. This is how tcomb stores them.
+// 16x1:   tiles of 16 pixels of one row, left to right and top to bottom.
+//         Each holds the 16 pixels of the five fields and the three masks
+//         one after the other, so a row of the window is one stream.
+// 16x8:   tiles of 16x8 pixels, with the eight samples of each row of the
+//         tile one after the other.
+//
+// The tiled window is a ring: each new field and mask is copied over the
+// oldest one, and the kernels are told which sample is which. The copy is
+// timed on its own. The planar fields are used where they are.
+//
+// The kernels walk the whole plane, and the planar and tiled versions only
+// differ in how they step through memory. The work on 16 pixels is the
+// same code for all of them: that of the SSE2 kernels on x86, plain C
+// elsewhere.
+
+enum Layouts {
+    LayoutPlanar = 0,
+    LayoutTiles16x1,
+    LayoutTiles16x8,
+    NumLayouts
+};
+
+static const char *layout_names[NumLayouts] = { "planar", "16x1", "16x8" };
+
+static const int tile_heights[NumLayouts] = { 0, 1, 8 };
+
+#define TILE_WIDTH 16
+
+// Fields p2, p1, s1, n1, n2, then masks m1, m2, m3.
+#define WINDOW_SAMPLES 8
+
+// Enough of each that the planar windows move through memory like they do
+// in a stream, instead of staying in the cache.
+#define NUM_FIELDS 13
+#define NUM_MASKS 7
+
+#define PAGE_SIZE 4096
+
+
+#define min2(a,b) ((a) > (b) ? (b) : (a))
+#define max2(a,b) ((a) > (b) ? (a) : (b))
+#define min3(a,b,c) min2(min2(a,b),c)
+#define max3(a,b,c) max2(max2(a,b),c)
+
+
+#if defined(TCOMB_X86)
+
+#define zeroes _mm_setzero_si128()
+
+static inline void oscillation16(const uint8_t *p2p, const uint8_t *p1p, const uint8_t *s1p,
+        const uint8_t *n1p, const uint8_t *n2p, uint8_t *dstp, int thresh)
+{
+    const __m128i th = _mm_set1_epi8(thresh - 1);
+    const __m128i bytes_1 = _mm_set1_epi8(1);
+
+    __m128i p2 = _mm_load_si128((const __m128i *)p2p);
+    __m128i s1 = _mm_load_si128((const __m128i *)s1p);
+    __m128i n2 = _mm_load_si128((const __m128i *)n2p);
+    __m128i p1 = _mm_load_si128((const __m128i *)p1p);
+    __m128i n1 = _mm_load_si128((const __m128i *)n1p);
+
+    __m128i min31 = _mm_min_epu8(_mm_min_epu8(p2, s1), n2);
+    __m128i max31 = _mm_max_epu8(_mm_max_epu8(p2, s1), n2);
+    __m128i min22 = _mm_min_epu8(p1, n1);
+    __m128i max22 = _mm_max_epu8(p1, n1);
+
+    __m128i range22 = _mm_cmpeq_epi8(_mm_subs_epu8(_mm_subs_epu8(max22, min22), th), zeroes);
+    __m128i range31 = _mm_cmpeq_epi8(_mm_subs_epu8(_mm_subs_epu8(max31, min31), th), zeroes);
+    __m128i below = _mm_cmpeq_epi8(_mm_subs_epu8(max31, _mm_subs_epu8(min22, bytes_1)), zeroes);
+    __m128i above = _mm_cmpeq_epi8(_mm_subs_epu8(max22, _mm_subs_epu8(min31, bytes_1)), zeroes);
+
+    _mm_store_si128((__m128i *)dstp, _mm_and_si128(_mm_or_si128(below, above), _mm_and_si128(range22, range31)));
+}
+
+
+// (a + b * 2 + c + 2) / 4
+static inline __m128i blur121(__m128i a, __m128i b, __m128i c)
+{
+    const __m128i words_2 = _mm_set1_epi16(2);
+
+    __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zeroes), _mm_unpacklo_epi8(c, zeroes));
+    __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zeroes), _mm_unpackhi_epi8(c, zeroes));
+
+    lo = _mm_add_epi16(lo, _mm_slli_epi16(_mm_unpacklo_epi8(b, zeroes), 1));
+    hi = _mm_add_epi16(hi, _mm_slli_epi16(_mm_unpackhi_epi8(b, zeroes), 1));
+
+    lo = _mm_srli_epi16(_mm_add_epi16(lo, words_2), 2);
+    hi = _mm_srli_epi16(_mm_add_epi16(hi, words_2), 2);
+
+    return _mm_packus_epi16(lo, hi);
+}
+
+
+// 0xFF where the mask is set and min <= val <= max.
+static inline __m128i acceptable(__m128i mask, __m128i val, __m128i min, __m128i max)
+{
+    __m128i ok = _mm_and_si128(_mm_cmpeq_epi8(_mm_max_epu8(val, min), val),
+                               _mm_cmpeq_epi8(_mm_min_epu8(val, max), val));
+
+    return _mm_andnot_si128(_mm_cmpeq_epi8(mask, zeroes), ok);
+}
+
+
+static inline void final16(const uint8_t *p2p, const uint8_t *p1p, const uint8_t *srcp,
+        const uint8_t *n1p, const uint8_t *n2p, const uint8_t *m1p, const uint8_t *m2p, const uint8_t *m3p,
+        const uint8_t *minp, const uint8_t *maxp, uint8_t *dstp)
+{
+    __m128i p2 = _mm_load_si128((const __m128i *)p2p);
+    __m128i p1 = _mm_load_si128((const __m128i *)p1p);
+    __m128i s = _mm_load_si128((const __m128i *)srcp);
+    __m128i n1 = _mm_load_si128((const __m128i *)n1p);
+    __m128i n2 = _mm_load_si128((const __m128i *)n2p);
+    __m128i min = _mm_load_si128((const __m128i *)minp);
+    __m128i max = _mm_load_si128((const __m128i *)maxp);
+
+    __m128i v2 = blur121(p1, s, n1);
+    __m128i v1 = blur121(p2, p1, s);
+    __m128i v3 = blur121(s, n1, n2);
+
+    __m128i ok2 = acceptable(_mm_load_si128((const __m128i *)m2p), v2, min, max);
+    __m128i ok1 = _mm_andnot_si128(ok2, acceptable(_mm_load_si128((const __m128i *)m1p), v1, min, max));
+    __m128i ok3 = _mm_andnot_si128(_mm_or_si128(ok2, ok1), acceptable(_mm_load_si128((const __m128i *)m3p), v3, min, max));
+    __m128i any = _mm_or_si128(_mm_or_si128(ok2, ok1), ok3);
+
+    __m128i vals = _mm_or_si128(_mm_or_si128(_mm_and_si128(ok2, v2), _mm_and_si128(ok1, v1)), _mm_and_si128(ok3, v3));
+
+    __m128i d = _mm_load_si128((const __m128i *)dstp);
+    _mm_store_si128((__m128i *)dstp, _mm_or_si128(_mm_andnot_si128(any, d), vals));
+}
+
+#else
+
+static inline void oscillation16(const uint8_t *p2p, const uint8_t *p1p, const uint8_t *s1p,
+        const uint8_t *n1p, const uint8_t *n2p, uint8_t *dstp, int thresh)
+{
+    for (int x = 0; x < TILE_WIDTH; ++x) {
+        const int min31 = min3(p2p[x], s1p[x], n2p[x]);
+        const int max31 = max3(p2p[x], s1p[x], n2p[x]);
+        const int min22 = min2(p1p[x], n1p[x]);
+        const int max22 = max2(p1p[x], n1p[x]);
+        if (((min31 > max22) || max22 == 0 || (max31 < min22) || max31 == 0) &&
+                max31 - min31 < thresh && max22 - min22 < thresh)
+            dstp[x] = 0xFF;
+        else
+            dstp[x] = 0;
+    }
+}
+
+
+static inline void final16(const uint8_t *p2p, const uint8_t *p1p, const uint8_t *srcp,
+        const uint8_t *n1p, const uint8_t *n2p, const uint8_t *m1p, const uint8_t *m2p, const uint8_t *m3p,
+        const uint8_t *minp, const uint8_t *maxp, uint8_t *dstp)
+{
+    for (int x = 0; x < TILE_WIDTH; ++x) {
+        if (m2p[x]) {
+            const int val = (p1p[x] + (srcp[x] * 2) + n1p[x] + 2) / 4;
+            if (val >= minp[x] && val <= maxp[x]) {
+                dstp[x] = val;
+                continue;
+            }
+        }
+        if (m1p[x]) {
+            const int val = (p2p[x] + (p1p[x] * 2) + srcp[x] + 2) / 4;
+            if (val >= minp[x] && val <= maxp[x]) {
+                dstp[x] = val;
+                continue;
+            }
+        }
+        if (m3p[x]) {
+            const int val = (srcp[x] + (n1p[x] * 2) + n2p[x] + 2) / 4;
+            if (val >= minp[x] && val <= maxp[x])
+                dstp[x] = val;
+        }
+    }
+}
+
+#endif
+
+
+typedef struct Pool {
+    void *memory[NUM_FIELDS + NUM_MASKS + 4];
+    int count;
+} Pool;
+
+
+static uint32_t seed = 1;
+
+static int randomByte(void)
+{
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 16) & 255;
+}
+
+
+static int alignedWidth(const TCombFilter *f, int b)
+{
+    return (f->fieldWidth[b] + TILE_WIDTH - 1) & ~(TILE_WIDTH - 1);
+}
+
+
+// Page aligned, with the planes one after another. A tiled window holds
+// WINDOW_SAMPLES samples of every pixel; its stride is that of the rows
+// of tiles.
+static int allocFrame(Pool *pool, const TCombFilter *f, TCombFrame *frame, int layout)
+{
+    const int samples = layout == LayoutPlanar ? 1 : WINDOW_SAMPLES;
+    size_t offsets[3] = { 0 };
+    size_t size = 0;
+
+    memset(frame, 0, sizeof(*frame));
+
+    for (int b = 0; b < f->numPlanes; ++b) {
+        frame->stride[b] = alignedWidth(f, b) * samples;
+        offsets[b] = size;
+        size += (size_t)frame->stride[b] * f->fieldHeight[b];
+    }
+
+    void *memory = malloc(size + PAGE_SIZE);
+    if (!memory)
+        return 0;
+    pool->memory[pool->count++] = memory;
+
+    uint8_t *base = (uint8_t *)(((uintptr_t)memory + PAGE_SIZE - 1) & ~(uintptr_t)(PAGE_SIZE - 1));
+
+    for (int b = 0; b < f->numPlanes; ++b)
+        frame->data[b] = base + offsets[b];
+
+    return 1;
+}
+
+
+// Noise on top of a pattern that alternates every field, so that the
+// oscillation checks find something. Masks get about a quarter set.
+static void fillFrame(const TCombFilter *f, TCombFrame *frame, int n, int mask)
+{
+    for (int b = 0; b < f->numPlanes; ++b) {
+        for (int y = 0; y < f->fieldHeight[b]; ++y) {
+            uint8_t *p = frame->data[b] + (size_t)y * frame->stride[b];
+
+            for (int x = 0; x < frame->stride[b]; ++x) {
+                if (mask)
+                    p[x] = (randomByte() & 3) ? 0 : 255;
+                else
+                    p[x] = 128 + (((x + y + n) & 1) ? 3 : -3) + (randomByte() & 1);
+            }
+        }
+    }
+}
+
+
+// Copies src into sample k of the tiles of window, the way a new field
+// would be added to it.
+static void fillSample(const TCombFilter *f, int layout, const TCombFrame *src, TCombFrame *window, int k)
+{
+    for (int b = 0; b < f->numPlanes; ++b) {
+        const int width = alignedWidth(f, b);
+        const int height = f->fieldHeight[b];
+        const int tile_height = tile_heights[layout];
+
+        for (int top = 0; top < height; top += tile_height) {
+            const int rows = min2(tile_height, height - top);
+            uint8_t *tile = window->data[b] + (size_t)top * window->stride[b] + k * TILE_WIDTH;
+
+            for (int x = 0; x < width; x += TILE_WIDTH, tile += TILE_WIDTH * WINDOW_SAMPLES * rows) {
+                const uint8_t *srcp = src->data[b] + (size_t)top * src->stride[b] + x;
+
+                for (int y = 0; y < rows; ++y)
+                    memcpy(tile + y * TILE_WIDTH * WINDOW_SAMPLES, srcp + y * src->stride[b], TILE_WIDTH);
+            }
+        }
+    }
+}
+
+
+// src holds the planar samples in window order.
+static void oscillationPlanar(const TCombFilter *f, const TCombFrame src[WINDOW_SAMPLES], TCombFrame *dst)
+{
+    for (int b = 0; b < f->numPlanes; ++b) {
+        const int thresh = b == 0 ? f->params.othreshl : f->params.othreshc;
+        const int width = alignedWidth(f, b);
+        const uint8_t *p2p = src[0].data[b];
+        const uint8_t *p1p = src[1].data[b];
+        const uint8_t *s1p = src[2].data[b];
+        const uint8_t *n1p = src[3].data[b];
+        const uint8_t *n2p = src[4].data[b];
+        uint8_t *dstp = dst->data[b];
+
+        for (int y = 0; y < f->fieldHeight[b]; ++y) {
+            for (int x = 0; x < width; x += TILE_WIDTH)
+                oscillation16(p2p + x, p1p + x, s1p + x, n1p + x, n2p + x, dstp + x, thresh);
+
+            p2p += src[0].stride[b];
+            p1p += src[1].stride[b];
+            s1p += src[2].stride[b];
+            n1p += src[3].stride[b];
+            n2p += src[4].stride[b];
+            dstp += dst->stride[b];
+        }
+    }
+}
+
+
+// sample[k] is where the k-th sample of the window is in the tiles.
+static void oscillationTiled(const TCombFilter *f, int layout, const TCombFrame *window, const int sample[WINDOW_SAMPLES], TCombFrame *dst)
+{
+    const int tile_height = tile_heights[layout];
+    const int step = TILE_WIDTH * WINDOW_SAMPLES;
+    const int o0 = sample[0] * TILE_WIDTH;
+    const int o1 = sample[1] * TILE_WIDTH;
+    const int o2 = sample[2] * TILE_WIDTH;
+    const int o3 = sample[3] * TILE_WIDTH;
+    const int o4 = sample[4] * TILE_WIDTH;
+
+    for (int b = 0; b < f->numPlanes; ++b) {
+        const int thresh = b == 0 ? f->params.othreshl : f->params.othreshc;
+        const int width = alignedWidth(f, b);
+        const int height = f->fieldHeight[b];
+
+        for (int top = 0; top < height; top += tile_height) {
+            const int rows = min2(tile_height, height - top);
+            const uint8_t *tile = window->data[b] + (size_t)top * window->stride[b];
+            uint8_t *dstp = dst->data[b] + (size_t)top * dst->stride[b];
+
+            for (int x = 0; x < width; x += TILE_WIDTH) {
+                uint8_t *d = dstp + x;
+
+                for (int y = 0; y < rows; ++y, tile += step, d += dst->stride[b])
+                    oscillation16(tile + o0, tile + o1, tile + o2, tile + o3, tile + o4, d, thresh);
+            }
+        }
+    }
+}
+
+
+static void finalPlanar(const TCombFilter *f, const TCombFrame src[WINDOW_SAMPLES],
+        const TCombFrame *min, const TCombFrame *max, TCombFrame *dst)
+{
+    for (int b = 0; b < f->numPlanes; ++b) {
+        const int width = alignedWidth(f, b);
+        const uint8_t *p[WINDOW_SAMPLES];
+        for (int k = 0; k < WINDOW_SAMPLES; ++k)
+            p[k] = src[k].data[b];
+        const uint8_t *minp = min->data[b];
+        const uint8_t *maxp = max->data[b];
+        uint8_t *dstp = dst->data[b];
+
+        for (int y = 0; y < f->fieldHeight[b]; ++y) {
+            for (int x = 0; x < width; x += TILE_WIDTH)
+                final16(p[0] + x, p[1] + x, p[2] + x, p[3] + x, p[4] + x, p[5] + x, p[6] + x, p[7] + x,
+                        minp + x, maxp + x, dstp + x);
+
+            for (int k = 0; k < WINDOW_SAMPLES; ++k)
+                p[k] += src[k].stride[b];
+            minp += min->stride[b];
+            maxp += max->stride[b];
+            dstp += dst->stride[b];
+        }
+    }
+}
+
+
+static void finalTiled(const TCombFilter *f, int layout, const TCombFrame *window, const int sample[WINDOW_SAMPLES],
+        const TCombFrame *min, const TCombFrame *max, TCombFrame *dst)
+{
+    const int tile_height = tile_heights[layout];
+    const int step = TILE_WIDTH * WINDOW_SAMPLES;
+    int o[WINDOW_SAMPLES];
+    for (int k = 0; k < WINDOW_SAMPLES; ++k)
+        o[k] = sample[k] * TILE_WIDTH;
+
+    for (int b = 0; b < f->numPlanes; ++b) {
+        const int width = alignedWidth(f, b);
+        const int height = f->fieldHeight[b];
+        const int stride = dst->stride[b];
+
+        for (int top = 0; top < height; top += tile_height) {
+            const int rows = min2(tile_height, height - top);
+            const uint8_t *tile = window->data[b] + (size_t)top * window->stride[b];
+            const size_t offset = (size_t)top * stride;
+
+            for (int x = 0; x < width; x += TILE_WIDTH) {
+                const uint8_t *minp = min->data[b] + offset + x;
+                const uint8_t *maxp = max->data[b] + offset + x;
+                uint8_t *d = dst->data[b] + offset + x;
+
+                for (int y = 0; y < rows; ++y, tile += step, minp += stride, maxp += stride, d += stride)
+                    final16(tile + o[0], tile + o[1], tile + o[2], tile + o[3], tile + o[4], tile + o[5], tile + o[6], tile + o[7],
+                            minp, maxp, d);
+            }
+        }
+    }
+}
+
+
+static double seconds(clock_t start)
+{
+    return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+
+// Fills us with the time per field in microseconds of checkOscillation5,
+// of buildFinalFrame, and of copying a field and a mask into the tiles.
+// Returns 0 if the memory ran out.
+static int measure(const TCombFilter *f, int layout, double us[3])
+{
+    Pool pool = { { NULL }, 0 };
+    TCombFrame fields[NUM_FIELDS], masks[NUM_MASKS];
+    TCombFrame window, dst, min, max;
+    int ok = 1;
+
+    for (int i = 0; i < NUM_FIELDS; ++i)
+        ok = ok && allocFrame(&pool, f, &fields[i], LayoutPlanar);
+    for (int i = 0; i < NUM_MASKS; ++i)
+        ok = ok && allocFrame(&pool, f, &masks[i], LayoutPlanar);
+    if (layout != LayoutPlanar)
+        ok = ok && allocFrame(&pool, f, &window, layout);
+    ok = ok && allocFrame(&pool, f, &dst, LayoutPlanar);
+    ok = ok && allocFrame(&pool, f, &min, LayoutPlanar);
+    ok = ok && allocFrame(&pool, f, &max, LayoutPlanar);
+
+    if (ok) {
+        seed = 1;
+        for (int i = 0; i < NUM_FIELDS; ++i)
+            fillFrame(f, &fields[i], i, 0);
+        for (int i = 0; i < NUM_MASKS; ++i)
+            fillFrame(f, &masks[i], i, 1);
+
+        // Roughly half of the values pass.
+        fillFrame(f, &min, 0, 0);
+        fillFrame(f, &max, 1, 0);
+
+        // Field n + j goes in sample (n + j) % 5, mask n + j in
+        // 5 + (n + j) % 3.
+        if (layout != LayoutPlanar) {
+            for (int j = 0; j < 5; ++j)
+                fillSample(f, layout, &fields[j], &window, j);
+            for (int j = 0; j < 3; ++j)
+                fillSample(f, layout, &masks[j], &window, 5 + j);
+        }
+
+        // Copying alone, then copying followed by each kernel. The kernels
+        // get what's left after the copy.
+        double copy = 0;
+
+        for (int pass = layout == LayoutPlanar ? 1 : 0; pass < 3; ++pass) {
+            clock_t start = clock();
+            int n = 0;
+
+            // At least a quarter of a second.
+            do {
+                for (int i = 0; i < 16; ++i, ++n) {
+                    TCombFrame src[WINDOW_SAMPLES];
+                    int sample[WINDOW_SAMPLES];
+
+                    for (int j = 0; j < 5; ++j) {
+                        src[j] = fields[(n + j) % NUM_FIELDS];
+                        sample[j] = (n + j) % 5;
+                    }
+                    for (int j = 0; j < 3; ++j) {
+                        src[5 + j] = masks[(n + j) % NUM_MASKS];
+                        sample[5 + j] = 5 + (n + j) % 3;
+                    }
+
+                    if (layout == LayoutPlanar) {
+                        if (pass == 1)
+                            oscillationPlanar(f, src, &dst);
+                        else
+                            finalPlanar(f, src, &min, &max, &dst);
+                        continue;
+                    }
+
+                    // The window moves on by one field.
+                    fillSample(f, layout, &src[4], &window, sample[4]);
+                    fillSample(f, layout, &src[7], &window, sample[7]);
+
+                    if (pass == 1)
+                        oscillationTiled(f, layout, &window, sample, &dst);
+                    else if (pass == 2)
+                        finalTiled(f, layout, &window, sample, &min, &max, &dst);
+                }
+            } while (seconds(start) < 0.25);
+
+            const double time = seconds(start) * 1e6 / n;
+
+            if (pass == 0)
+                copy = time;
+            else
+                us[pass - 1] = time - copy;
+        }
+
+        us[2] = copy;
+    }
+
+    for (int i = 0; i < pool.count; ++i)
+        free(pool.memory[i]);
+
+    return ok;
+}
+
+
+int main(int argc, char **argv)
+{
+    static const char *default_sizes[] = { "720x240", "1440x540" };
+
+    const char **sizes = default_sizes;
+    int num_sizes = 2;
+
+    if (argc > 1) {
+        if (!strcmp(argv[1], "-h") || !strcmp(argv[1], "--help")) {
+            fprintf(stderr,
+                    "Usage: tcomb-bench [WIDTHxHEIGHT]...\n"
+                    "\n"
+                    "Times the checkOscillation5 and buildFinalFrame loops on 4:2:0\n"
+                    "fields of the given sizes [720x240 1440x540], with one plane per\n"
+                    "field and with the fields interleaved in 16x1 and 16x8 tiles, and\n"
+                    "the copy of a field and a mask into the tiles.\n");
+            return 0;
+        }
+
+        sizes = (const char **)argv + 1;
+        num_sizes = argc - 1;
+    }
+
+    printf("%-12s %-8s %16s %12s %12s\n", "field", "layout", "oscillation us", "final us", "copy us");
+
+    for (int i = 0; i < num_sizes; ++i) {
+        int width, height;
+        if (sscanf(sizes[i], "%dx%d", &width, &height) != 2) {
+            fprintf(stderr, "tcomb-bench: Invalid size '%s'.\n", sizes[i]);
+            return 1;
+        }
+
+        TCombParams params;
+        tcombParamsDefault(&params);
+
+        TCombFormat format = { width, height, 3, 1, 1 };
+        TCombFilter filter;
+
+        const char *error = tcombFilterInit(&filter, &params, &format);
+        if (error || width % 2 || height % 2) {
+            fprintf(stderr, "tcomb-bench: %s\n", error ? error : "Sizes must be even for 4:2:0.");
+            return 1;
+        }
+
+        double best[NumLayouts][3];
+
+        // The layouts take turns so that whatever else the machine is doing
+        // affects all of them alike. The best of five rounds counts.
+        for (int round = 0; round < 5; ++round) {
+            for (int layout = 0; layout < NumLayouts; ++layout) {
+                double us[3];
+
+                if (!measure(&filter, layout, us)) {
+                    fprintf(stderr, "tcomb-bench: Out of memory.\n");
+                    return 1;
+                }
+
+                for (int kernel = 0; kernel < 3; ++kernel)
+                    if (!round || us[kernel] < best[layout][kernel])
+                        best[layout][kernel] = us[kernel];
+            }
+        }
+
+        for (int layout = 0; layout < NumLayouts; ++layout)
+            printf("%-12s %-8s %16.1f %12.1f %12.1f\n", sizes[i], layout_names[layout], best[layout][0], best[layout][1], best[layout][2]);
+    }
+
+    return 0;
+}
@@ -0,0 +1,1451 @@
+/*
+ **
+ **   TComb is a temporal comb filter (it reduces cross-luminance (rainbowing)
+ **   and cross-chrominance (dot crawl) artifacts in static areas of the picture).
+ **   It will ONLY work with NTSC material, and WILL NOT work with telecined material
+ **   where the rainbowing/dotcrawl was introduced prior to the telecine process!
+ **   It must be used before ivtc or deinterlace.
+ **
+ **   Copyright (C) 2005-2006 Kevin Stone
+ **
+ **   VapourSynth port by dubhater
+ **
+ **   This program is free software; you can redistribute it and/or modify
+ **   it under the terms of the GNU General Public License as published by
+ **   the Free Software Foundation; either version 2 of the License, or
+ **   (at your option) any later version.
+ **
+ **   This program is distributed in the hope that it will be useful,
+ **   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ **   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ **   GNU General Public License for more details.
+ **
+ **   You should have received a copy of the GNU General Public License
+ **   along with this program; if not, write to the Free Software
+ **   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "tcomb_core.h"
+
+
+#define min2(a,b) ((a) > (b) ? (b) : (a))
+#define max2(a,b) ((a) > (b) ? (a) : (b))
+#define min3(a,b,c) min2(min2(a,b),c)
+#define max3(a,b,c) max2(max2(a,b),c)
+#define min4(a,b,c,d) min2(min2(a,b),min2(c,d))
+#define max4(a,b,c,d) max2(max2(a,b),max2(c,d))
+
+
+#if defined(TCOMB_X86)
+#define TCOMB_SIMD
+#define SIMD(name) name##_sse2
+#elif defined(TCOMB_GENERIC)
+#define TCOMB_SIMD
+#define SIMD(name) name##_generic
+#endif
+
+
+#ifdef TCOMB_SIMD
+// Implemented in simd_sse2.c or simd_generic.c
+extern void SIMD(buildFinalMask)( const uint8_t *s1p, const uint8_t *s2p, const uint8_t *m1p, uint8_t *dstp, intptr_t src_stride, intptr_t dst_stride, intptr_t width, intptr_t height, intptr_t thresh);
+extern void SIMD(absDiff)( const uint8_t *srcp1, const uint8_t *srcp2, uint8_t *dstp, intptr_t src_stride, intptr_t dst_stride, intptr_t width, intptr_t height);
+extern void SIMD(absDiffAndMinMask)( const uint8_t *srcp1, const uint8_t *srcp2, uint8_t *dstp, intptr_t stride, intptr_t width, intptr_t height);
+extern void SIMD(absDiffAndMinMaskThresh)( const uint8_t *srcp1, const uint8_t *srcp2, uint8_t *dstp, intptr_t stride, intptr_t width, intptr_t height, intptr_t thresh);
+extern void SIMD(checkOscillation5)( const uint8_t *p2p, const uint8_t *p1p, const uint8_t *s1p, const uint8_t *n1p, const uint8_t *n2p, uint8_t *dstp, intptr_t src_stride, intptr_t dst_stride, intptr_t width, intptr_t height, intptr_t thresh);
+extern void SIMD(calcAverages)( const uint8_t *s1p, const uint8_t *s2p, uint8_t *dstp, intptr_t src_stride, intptr_t dst_stride, intptr_t width, intptr_t height);
+extern void SIMD(checkAvgOscCorrelation)( const uint8_t *s1p, const uint8_t *s2p, const uint8_t *s3p, const uint8_t *s4p, uint8_t *dstp, intptr_t stride, intptr_t width, intptr_t height, intptr_t thresh);
+extern void SIMD(checkAvgOscCorrelationFields)( const uint8_t *c1p, const uint8_t *p1p, const uint8_t *c2p, const uint8_t *p2p, const uint8_t *c3p, const uint8_t *p3p, const uint8_t *c4p, const uint8_t *p4p, uint8_t *dstp, intptr_t src_stride, intptr_t dst_stride, intptr_t width, intptr_t height, intptr_t thresh);
+extern void SIMD(or3Masks)( const uint8_t *s1p, const uint8_t *s2p, const uint8_t *s3p, uint8_t *dstp, intptr_t stride, intptr_t width, intptr_t height);
+extern void SIMD(orAndMasks)( const uint8_t *s1p, const uint8_t *s2p, uint8_t *dstp, intptr_t stride, intptr_t width, intptr_t height);
+extern void SIMD(andMasks)( const uint8_t *s1p, const uint8_t *s2p, uint8_t *dstp, intptr_t stride, intptr_t width, intptr_t height);
+extern void SIMD(or4Masks)( const uint8_t *s1p, const uint8_t *s2p, const uint8_t *s3p, const uint8_t *s4p, uint8_t *dstp, intptr_t stride, intptr_t width, intptr_t height);
+extern void SIMD(checkSceneChange)( const uint8_t *s1p, const uint8_t *s2p, intptr_t height, intptr_t width, intptr_t stride, int64_t *diffp);
+extern void SIMD(verticalBlur3)( const uint8_t *srcp, uint8_t *dstp, intptr_t src_stride, intptr_t dst_stride, intptr_t width, intptr_t height);
+extern void SIMD(andNeighborsInPlace)( uint8_t *srcp, intptr_t width, intptr_t height, intptr_t stride);
+extern void SIMD(minMax)( const uint8_t *srcp, uint8_t *minp, uint8_t *maxp, intptr_t width, intptr_t height, intptr_t src_stride, intptr_t min_stride, intptr_t thresh);
+extern void SIMD(horizontalBlur3)( const uint8_t *srcp, uint8_t *dstp, intptr_t src_stride, intptr_t dst_stride, intptr_t width, intptr_t height);
+extern void SIMD(horizontalBlur6)( const uint8_t *srcp, uint8_t *dstp, intptr_t src_stride, intptr_t dst_stride, intptr_t width, intptr_t height);
+extern void SIMD(buildFinalFrame)( const uint8_t *p2p, const uint8_t *p1p, const uint8_t *srcp, const uint8_t *n1p, const uint8_t *n2p, const uint8_t *m1p, const uint8_t *m2p, const uint8_t *m3p, const uint8_t *minp, const uint8_t *maxp, uint8_t *dstp, uint8_t *mapp, intptr_t src_stride, intptr_t msk_stride, intptr_t minmax_stride, intptr_t dst_stride, intptr_t width, intptr_t height, intptr_t map_only);
+#endif
+
+
+void tcombParamsDefault(TCombParams *params)
+{
+    params->mode = LumaAndChroma;
+    params->fthreshl = 4;
+    params->fthreshc = 5;
+    params->othreshl = 5;
+    params->othreshc = 6;
+    params->map = 0;
+    params->scthresh = 12.0;
+    params->preset = PresetFull;
+    params->left = 0;
+    params->top = 0;
+    params->right = 0;
+    params->bottom = 0;
+    params->lowmem = 0;
+}
+
+
+const char *tcombParamsCheck(const TCombParams *params)
+{
+    if (params->mode < LumaOnly || params->mode > LumaAndChroma)
+        return "TComb: mode must be 0, 1, or 2.";
+
+    if (params->fthreshl < 1 || params->fthreshl > 255)
+        return "TComb: fthreshl must be between 1 and 255 (inclusive).";
+
+    if (params->fthreshc < 1 || params->fthreshc > 255)
+        return "TComb: fthreshc must be between 1 and 255 (inclusive).";
+
+    if (params->othreshl < 1 || params->othreshl > 255)
+        return "TComb: othreshl must be between 1 and 255 (inclusive).";
+
+    if (params->othreshc < 1 || params->othreshc > 255)
+        return "TComb: othreshc must be between 1 and 255 (inclusive).";
+
+    if (params->scthresh > 100.0)
+        return "TComb: scthresh must not be more than 100.";
+
+    if (params->preset < PresetFull || params->preset > PresetFast)
+        return "TComb: preset must be 0 or 1.";
+
+    if (params->left < 0 || params->top < 0 || params->right < 0 || params->bottom < 0)
+        return "TComb: left, top, right, and bottom must not be negative.";
+
+    return NULL;
+}
+
+
+const char *tcombFilterInit(TCombFilter *filter, const TCombParams *params, const TCombFormat *format)
+{
+    const char *error = tcombParamsCheck(params);
+    if (error)
+        return error;
+
+    if (format->numPlanes != 1 && format->numPlanes != 3)
+        return "TComb: Input must be 8 bit Gray or YUV with constant format and dimensions.";
+
+    if (format->numPlanes == 1 && params->mode > LumaOnly)
+        return "TComb: Mode must be 0 when input is Gray.";
+
+    if (format->width < 4 || format->height < 3)
+        return "TComb: Input fields must be at least 4 pixels wide and 3 pixels tall.";
+
+    filter->params = *params;
+    filter->params.map = !!params->map;
+
+    // The left edge must leave every plane's pointers aligned. The other
+    // edges only have to fall on whole chroma pixels.
+    const int align = TCOMB_ALIGNMENT << format->subSamplingW;
+    const int left = params->left / align * align;
+    const int right = params->right >> format->subSamplingW << format->subSamplingW;
+    const int top = params->top >> format->subSamplingH << format->subSamplingH;
+    const int bottom = params->bottom >> format->subSamplingH << format->subSamplingH;
+
+    if (format->width - left - right < 4 || format->height - top - bottom < 3)
+        return "TComb: The processed area must be at least 4 pixels wide and 3 pixels tall.";
+
+    filter->numPlanes = format->numPlanes;
+    for (int b = 0; b < 3; ++b) {
+        const int ssw = b ? format->subSamplingW : 0;
+        const int ssh = b ? format->subSamplingH : 0;
+
+        filter->fieldWidth[b] = format->width >> ssw;
+        filter->fieldHeight[b] = format->height >> ssh;
+        filter->left[b] = left >> ssw;
+        filter->top[b] = top >> ssh;
+        filter->width[b] = filter->fieldWidth[b] - filter->left[b] - (right >> ssw);
+        filter->height[b] = filter->fieldHeight[b] - filter->top[b] - (bottom >> ssh);
+    }
+
+    filter->start = 0;
+    filter->stop = 3;
+
+    if (params->mode == LumaOnly)
+        filter->stop = 1;
+    if (params->mode == ChromaOnly)
+        filter->start = 1;
+
+    filter->diffmaxsc = (int64_t)((filter->width[0] / 16) * 16) * filter->height[0] * 219;
+    if (params->scthresh >= 0.0)
+        filter->diffmaxsc = (int64_t)(filter->diffmaxsc * params->scthresh / 100.0);
+
+    return NULL;
+}
+
+
+int tcombFilterProcessesLuma(const TCombFilter *filter)
+{
+    return filter->params.mode == LumaOnly || filter->params.mode == LumaAndChroma;
+}
+
+
+int tcombFilterProcessesChroma(const TCombFilter *filter)
+{
+    return filter->params.mode == ChromaOnly || filter->params.mode == LumaAndChroma;
+}
+
+
+TCombFrame tcombActiveView(const TCombFilter *filter, const TCombFrame *frame)
+{
+    TCombFrame view = *frame;
+
+    for (int b = 0; b < filter->numPlanes; ++b)
+        if (view.data[b])
+            view.data[b] += filter->top[b] * view.stride[b] + filter->left[b];
+
+    return view;
+}
+
+
+static void activeViews(const TCombFilter *filter, const TCombFrame *frames, TCombFrame *views, int count)
+{
+    for (int i = 0; i < count; ++i)
+        views[i] = tcombActiveView(filter, &frames[i]);
+}
+
+
+static int isBlack(const uint8_t *p, int step, int count)
+{
+    for (int i = 0; i < count; ++i)
+        if (p[i * step] > TCOMB_BLACK)
+            return 0;
+    return 1;
+}
+
+
+int tcombFindBorders(const uint8_t *luma, int stride, int width, int height, int *left, int *top, int *right, int *bottom)
+{
+    int t = 0, b = 0, l = 0, r = 0;
+
+    while (t < height && isBlack(luma + t * stride, 1, width))
+        t++;
+
+    if (t == height)
+        return 0;
+
+    while (isBlack(luma + (height - 1 - b) * stride, 1, width))
+        b++;
+
+    const uint8_t *rows = luma + t * stride;
+    const int count = height - t - b;
+
+    while (isBlack(rows + l, stride, count))
+        l++;
+    while (isBlack(rows + width - 1 - r, stride, count))
+        r++;
+
+    *left = l;
+    *top = t;
+    *right = r;
+    *bottom = b;
+
+    return 1;
+}
+
+
+static void bitblt(uint8_t *dstp, int dst_stride, const uint8_t *srcp, int src_stride, int row_size, int height)
+{
+    for (int y = 0; y < height; ++y) {
+        memcpy(dstp, srcp, row_size);
+        srcp += src_stride;
+        dstp += dst_stride;
+    }
+}
+
+
+static void copyPad(const TCombFrame *src, TCombFrame *dst, const TCombFilter *f)
+{
+    for (int b = f->start; b < f->stop; ++b) {
+        const int pitch = dst->stride[b];
+
+        bitblt(dst->data[b] + pitch + 1, pitch,
+                src->data[b], src->stride[b],
+                f->width[b], f->height[b]);
+
+        // Every row gets its edges replicated, including the first and the
+        // last one, so that nothing is read from uninitialised memory.
+        const int width = f->width[b] + 2;
+        const int height = f->height[b] + 2;
+
+        uint8_t *dstp = dst->data[b] + pitch;
+        for (int y = 1; y < height - 1; ++y) {
+            dstp[0] = dstp[1];
+            dstp[width - 1] = dstp[width - 2];
+            dstp += pitch;
+        }
+
+        dstp = dst->data[b];
+        memcpy(dstp, dstp + pitch, pitch);
+        memcpy(dstp + pitch * (height - 1), dstp + pitch * (height - 2), pitch);
+    }
+}
+
+
+static void MinMax(const TCombFrame *src, TCombFrame *dmin, TCombFrame *dmax, TCombFrame *pad, const TCombFilter *f)
+{
+    copyPad(src, pad, f);
+
+    for (int b = f->start; b < f->stop; ++b) {
+        const int src_pitch = pad->stride[b];
+        const uint8_t *srcp = pad->data[b] + src_pitch + 1;
+        const int width = f->width[b];
+        const int height = f->height[b];
+        uint8_t *dminp = dmin->data[b];
+        const int dmin_pitch = dmin->stride[b];
+        uint8_t *dmaxp = dmax->data[b];
+
+        const int thresh = b == 0 ? 2 : 8;
+
+#ifdef TCOMB_SIMD
+        SIMD(minMax)(srcp, dminp, dmaxp, width, height, src_pitch, dmin_pitch, thresh);
+#else
+        const uint8_t *srcpp = srcp - src_pitch;
+        const uint8_t *srcpn = srcp + src_pitch;
+
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                dminp[x] = max2(min2(min2(min2(min2(srcpp[x - 1], srcpp[x]),
+                                    min2(srcpp[x + 1], srcp[x - 1])),
+                                min2(min2(srcp[x], srcp[x + 1]),
+                                    min2(srcpn[x - 1], srcpn[x]))), srcpn[x + 1]) - thresh, 0);
+                dmaxp[x] = min2(max2(max2(max2(max2(srcpp[x - 1], srcpp[x]),
+                                    max2(srcpp[x + 1], srcp[x - 1])),
+                                max2(max2(srcp[x], srcp[x + 1]),
+                                    max2(srcpn[x - 1], srcpn[x]))), srcpn[x + 1]) + thresh, 255);
+            }
+            srcpp += src_pitch;
+            srcp += src_pitch;
+            srcpn += src_pitch;
+            dminp += dmin_pitch;
+            dmaxp += dmin_pitch;
+        }
+#endif
+    }
+}
+
+
+static void buildFinalFrame(const TCombFrame *p2, const TCombFrame *p1, const TCombFrame *src,
+        const TCombFrame *n1, const TCombFrame *n2, const TCombFrame *m1, const TCombFrame *m2, const TCombFrame *m3,
+        TCombFrame *dst, TCombFrame *map, TCombFrame *min, TCombFrame *max, TCombFrame *pad, const TCombFilter *f)
+{
+    MinMax(src, min, max, pad, f);
+
+    for (int b = f->start; b < f->stop; ++b) {
+        const uint8_t *p2p = p2->data[b];
+        const int p2_pitch = p2->stride[b];
+        const uint8_t *p1p = p1->data[b];
+        const int p1_pitch = p1->stride[b];
+        const uint8_t *srcp = src->data[b];
+        const int src_pitch = src->stride[b];
+        const int height = f->height[b];
+        const int width = f->width[b];
+        const uint8_t *n1p = n1->data[b];
+        const int n1_pitch = n1->stride[b];
+        const uint8_t *n2p = n2->data[b];
+        const int n2_pitch = n2->stride[b];
+        const uint8_t *m1p = m1->data[b];
+        const int m1_pitch = m1->stride[b];
+        const uint8_t *m2p = m2->data[b];
+        const int m2_pitch = m2->stride[b];
+        const uint8_t *m3p = m3->data[b];
+        const int m3_pitch = m3->stride[b];
+        const uint8_t *minp = min->data[b];
+        const int min_pitch = min->stride[b];
+        const uint8_t *maxp = max->data[b];
+        const int max_pitch = max->stride[b];
+        uint8_t *dstp = dst->data[b];
+        const int dst_pitch = dst->stride[b];
+
+        int from = 0;
+
+#ifdef TCOMB_SIMD
+        // Whole blocks of 16 pixels go through the SIMD version. The
+        // remainder at the right edge can't be written past, as it may
+        // border on pixels outside the processed area.
+        const int map_stride = map ? map->stride[b] : dst_pitch;
+
+        if (p2_pitch == src_pitch && p1_pitch == src_pitch && n1_pitch == src_pitch && n2_pitch == src_pitch &&
+                m2_pitch == m1_pitch && m3_pitch == m1_pitch && max_pitch == min_pitch && map_stride == dst_pitch) {
+            from = width / 16 * 16;
+            SIMD(buildFinalFrame)(p2p, p1p, srcp, n1p, n2p, m1p, m2p, m3p, minp, maxp, dstp, map ? map->data[b] : NULL,
+                    src_pitch, m1_pitch, min_pitch, dst_pitch, from, height, f->params.map);
+        }
+#endif
+
+        if (from == width)
+            continue;
+
+        if (map) {
+            uint8_t *mapp = map->data[b];
+            const int map_pitch = map->stride[b];
+
+            for (int y = 0; y < height; ++y) {
+                for (int x = from; x < width; ++x) {
+                    if (m2p[x]) {
+                        const int val = (p1p[x] + (srcp[x] * 2) + n1p[x] + 2) / 4;
+                        if (val >= minp[x] && val <= maxp[x]) {
+                            dstp[x] = val;
+                            mapp[x] = 255;
+                            continue;
+                        }
+                    }
+                    if (m1p[x]) {
+                        const int val = (p2p[x] + (p1p[x] * 2) + srcp[x] + 2) / 4;
+                        if (val >= minp[x] && val <= maxp[x]) {
+                            dstp[x] = val;
+                            mapp[x] = 170;
+                            continue;
+                        }
+                    }
+                    if (m3p[x]) {
+                        const int val = (srcp[x] + (n1p[x] * 2) + n2p[x] + 2) / 4;
+                        if (val >= minp[x] && val <= maxp[x]) {
+                            dstp[x] = val;
+                            mapp[x] = 85;
+                            continue;
+                        }
+                    }
+                }
+                m1p += m1_pitch;
+                m2p += m2_pitch;
+                m3p += m3_pitch;
+                p2p += p2_pitch;
+                p1p += p1_pitch;
+                srcp += src_pitch;
+                n1p += n1_pitch;
+                n2p += n2_pitch;
+                dstp += dst_pitch;
+                mapp += map_pitch;
+                minp += min_pitch;
+                maxp += max_pitch;
+            }
+        } else if (!f->params.map) {
+            for (int y = 0; y < height; ++y) {
+                for (int x = from; x < width; ++x) {
+                    if (m2p[x]) {
+                        const int val = (p1p[x] + (srcp[x] * 2) + n1p[x] + 2) / 4;
+                        if (val >= minp[x] && val <= maxp[x]) {
+                            dstp[x] = val;
+                            continue;
+                        }
+                    }
+                    if (m1p[x]) {
+                        const int val = (p2p[x] + (p1p[x] * 2) + srcp[x] + 2) / 4;
+                        if (val >= minp[x] && val <= maxp[x]) {
+                            dstp[x] = val;
+                            continue;
+                        }
+                    }
+                    if (m3p[x]) {
+                        const int val = (srcp[x] + (n1p[x] * 2) + n2p[x] + 2) / 4;
+                        if (val >= minp[x] && val <= maxp[x]) {
+                            dstp[x] = val;
+                            continue;
+                        }
+                    }
+                }
+                m1p += m1_pitch;
+                m2p += m2_pitch;
+                m3p += m3_pitch;
+                p2p += p2_pitch;
+                p1p += p1_pitch;
+                srcp += src_pitch;
+                n1p += n1_pitch;
+                n2p += n2_pitch;
+                dstp += dst_pitch;
+                minp += min_pitch;
+                maxp += max_pitch;
+            }
+        } else {
+            for (int y = 0; y < height; ++y) {
+                for (int x = from; x < width; ++x) {
+                    if (m2p[x]) {
+                        const int val = (p1p[x] + (srcp[x] * 2) + n1p[x] + 2) / 4;
+                        if (val >= minp[x] && val <= maxp[x]) {
+                            dstp[x] = 255;
+                            continue;
+                        }
+                    }
+                    if (m1p[x]) {
+                        const int val = (p2p[x] + (p1p[x] * 2) + srcp[x] + 2) / 4;
+                        if (val >= minp[x] && val <= maxp[x]) {
+                            dstp[x] = 170;
+                            continue;
+                        }
+                    }
+                    if (m3p[x]) {
+                        const int val = (srcp[x] + (n1p[x] * 2) + n2p[x] + 2) / 4;
+                        if (val >= minp[x] && val <= maxp[x]) {
+                            dstp[x] = 85;
+                            continue;
+                        }
+                    }
+                }
+                m1p += m1_pitch;
+                m2p += m2_pitch;
+                m3p += m3_pitch;
+                p2p += p2_pitch;
+                p1p += p1_pitch;
+                srcp += src_pitch;
+                n1p += n1_pitch;
+                n2p += n2_pitch;
+                dstp += dst_pitch;
+                minp += min_pitch;
+                maxp += max_pitch;
+            }
+        }
+    }
+}
+
+
+static void buildFinalMask(const TCombFrame *s1, const TCombFrame *s2, const TCombFrame *m1,
+        TCombFrame *dst, const TCombFilter *f)
+{
+    for (int b = f->start; b < f->stop; ++b) {
+        const uint8_t *s1p = s1->data[b];
+        const int src_stride = s1->stride[b];
+        const int width = f->width[b];
+        const int height = f->height[b];
+        const uint8_t *s2p = s2->data[b];
+        const uint8_t *m1p = m1->data[b];
+        uint8_t *dstp = dst->data[b];
+        const int dst_stride = dst->stride[b];
+
+        const int thresh = b == 0 ? f->params.othreshl : f->params.othreshc;
+
+#ifdef TCOMB_SIMD
+        SIMD(buildFinalMask)(s1p, s2p, m1p, dstp, src_stride, dst_stride, width, height, thresh);
+#else
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                if (m1p[x] && abs(s1p[x] - s2p[x]) < thresh)
+                    dstp[x] = 0xFF;
+                else
+                    dstp[x] = 0;
+            }
+            m1p += dst_stride;
+            s1p += src_stride;
+            s2p += src_stride;
+            dstp += dst_stride;
+        }
+#endif
+    }
+}
+
+
+static void andNeighborsInPlace(TCombFrame *src, const TCombFilter *f)
+{
+    uint8_t *srcp = src->data[0];
+    const int height = f->height[0];
+    const int width = f->width[0];
+    const int src_pitch = src->stride[0];
+    uint8_t *srcpp = srcp - src_pitch;
+    uint8_t *srcpn = srcp + src_pitch;
+
+    srcp[0] &= (srcpn[0] | srcpn[1]);
+    for (int x = 1; x < width - 1; ++x)
+        srcp[x] &= (srcpn[x - 1] | srcpn[x] | srcpn[x + 1]);
+    srcp[width - 1] &= (srcpn[width - 2] | srcpn[width - 1]);
+    srcpp += src_pitch;
+    srcp += src_pitch;
+    srcpn += src_pitch;
+
+#ifdef TCOMB_SIMD
+    const int widtha = (width % 16) ? ((width / 16) * 16) : width - 16;
+
+    SIMD(andNeighborsInPlace)(srcp + 16, widtha - 16, height - 2, src_pitch);
+
+    for (int y = 1; y < height - 1; y++) {
+        srcp[0] &= (srcpp[0] | srcpp[1] | srcpn[0] | srcpn[1]);
+        for (int x = 1; x < 16; x++)
+            srcp[x] &= (srcpp[x - 1] | srcpp[x] | srcpp[x + 1] | srcpn[x - 1] | srcpn[x] | srcpn[x + 1]);
+
+        for (int x = widtha; x < width - 1; x++)
+            srcp[x] &= (srcpp[x - 1] | srcpp[x] | srcpp[x + 1] | srcpn[x - 1] | srcpn[x] | srcpn[x + 1]);
+        srcp[width - 1] &= (srcpp[width - 2] | srcpp[width - 1] | srcpn[width - 2] | srcpn[width - 1]);
+
+        srcpp += src_pitch;
+        srcp += src_pitch;
+        srcpn += src_pitch;
+    }
+#else
+    for (int y = 1; y < height - 1; ++y) {
+        srcp[0] &= (srcpp[0] | srcpp[1] | srcpn[0] | srcpn[1]);
+        for (int x = 1; x < width - 1; ++x)
+            srcp[x] &= (srcpp[x - 1] | srcpp[x] | srcpp[x + 1] | srcpn[x - 1] | srcpn[x] | srcpn[x + 1]);
+        srcp[width - 1] &= (srcpp[width - 2] | srcpp[width - 1] | srcpn[width - 2] | srcpn[width - 1]);
+        srcpp += src_pitch;
+        srcp += src_pitch;
+        srcpn += src_pitch;
+    }
+#endif
+
+    srcp[0] &= (srcpp[0] | srcpp[1]);
+    for (int x = 1; x < width - 1; ++x)
+        srcp[x] &= (srcpp[x - 1] | srcpp[x] | srcpp[x + 1]);
+    srcp[width - 1] &= (srcpp[width - 2] | srcpp[width - 1]);
+}
+
+
+static void absDiff(const TCombFrame *src1, const TCombFrame *src2, TCombFrame *dst, const TCombFilter *f)
+{
+    const uint8_t *srcp1 = src1->data[0];
+    const uint8_t *srcp2 = src2->data[0];
+    uint8_t *dstp = dst->data[0];
+    const int height = f->height[0];
+    const int width = f->width[0];
+    const int src_stride = src1->stride[0];
+    const int dst_stride = dst->stride[0];
+
+#ifdef TCOMB_SIMD
+    SIMD(absDiff)(srcp1, srcp2, dstp, src_stride, dst_stride, width, height);
+#else
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            dstp[x] = abs(srcp1[x] - srcp2[x]);
+        }
+        srcp1 += src_stride;
+        srcp2 += src_stride;
+        dstp += dst_stride;
+    }
+#endif
+}
+
+
+static void absDiffAndMinMask(const TCombFrame *src1, const TCombFrame *src2, TCombFrame *dst, const TCombFilter *f)
+{
+    const uint8_t *srcp1 = src1->data[0];
+    const uint8_t *srcp2 = src2->data[0];
+    uint8_t *dstp = dst->data[0];
+    const int height = f->height[0];
+    const int width = f->width[0];
+    const int stride = src1->stride[0];
+
+#ifdef TCOMB_SIMD
+    SIMD(absDiffAndMinMask)(srcp1, srcp2, dstp, stride, width, height);
+#else
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            const int diff = abs(srcp1[x] - srcp2[x]);
+            if (diff < dstp[x])
+                dstp[x] = diff;
+        }
+        srcp1 += stride;
+        srcp2 += stride;
+        dstp += stride;
+    }
+#endif
+}
+
+
+static void absDiffAndMinMaskThresh(const TCombFrame *src1, const TCombFrame *src2, TCombFrame *dst, const TCombFilter *f)
+{
+    const uint8_t *srcp1 = src1->data[0];
+    const uint8_t *srcp2 = src2->data[0];
+    uint8_t *dstp = dst->data[0];
+    const int height = f->height[0];
+    const int width = f->width[0];
+    const int stride = src1->stride[0];
+
+    const int thresh = f->params.fthreshl;
+
+#ifdef TCOMB_SIMD
+    SIMD(absDiffAndMinMaskThresh)(srcp1, srcp2, dstp, stride, width, height, thresh);
+#else
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            const int diff = abs(srcp1[x] - srcp2[x]);
+            if (diff < dstp[x])
+                dstp[x] = diff;
+            if (dstp[x] < thresh)
+                dstp[x] = 0xFF;
+            else
+                dstp[x] = 0;
+        }
+        srcp1 += stride;
+        srcp2 += stride;
+        dstp += stride;
+    }
+#endif
+}
+
+
+static void checkOscillation5(const TCombFrame *p2, const TCombFrame *p1, const TCombFrame *s1,
+        const TCombFrame *n1, const TCombFrame *n2, TCombFrame *dst, const TCombFilter *f)
+{
+    for (int b = f->start; b < f->stop; ++b) {
+        const uint8_t *p1p = p1->data[b];
+        const int src_stride = p1->stride[b];
+        const int width = f->width[b];
+        const int height = f->height[b];
+        const uint8_t *p2p = p2->data[b];
+        const uint8_t *s1p = s1->data[b];
+        const uint8_t *n1p = n1->data[b];
+        const uint8_t *n2p = n2->data[b];
+        uint8_t *dstp = dst->data[b];
+        const int dst_stride = dst->stride[b];
+
+        const int thresh = b == 0 ? f->params.othreshl : f->params.othreshc;
+
+#ifdef TCOMB_SIMD
+        SIMD(checkOscillation5)(p2p, p1p, s1p, n1p, n2p, dstp, src_stride, dst_stride, width, height, thresh);
+#else
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                const int min31 = min3(p2p[x], s1p[x], n2p[x]);
+                const int max31 = max3(p2p[x], s1p[x], n2p[x]);
+                const int min22 = min2(p1p[x], n1p[x]);
+                const int max22 = max2(p1p[x], n1p[x]);
+                if (((min31 > max22) || max22 == 0 || (max31 < min22) || max31 == 0) &&
+                        max31 - min31 < thresh && max22 - min22 < thresh)
+                    dstp[x] = 0xFF;
+                else
+                    dstp[x] = 0;
+            }
+            p2p += src_stride;
+            p1p += src_stride;
+            s1p += src_stride;
+            n1p += src_stride;
+            n2p += src_stride;
+            dstp += dst_stride;
+        }
+#endif
+    }
+}
+
+
+static void calcAverages(const TCombFrame *s1, const TCombFrame *s2, TCombFrame *dst, const TCombFilter *f)
+{
+    for (int b = f->start; b < f->stop; ++b) {
+        const uint8_t *s1p = s1->data[b];
+        const int src_stride = s1->stride[b];
+        const int height = f->height[b];
+        const int width = f->width[b];
+        const uint8_t *s2p = s2->data[b];
+        uint8_t *dstp = dst->data[b];
+        const int dst_stride = dst->stride[b];
+
+#ifdef TCOMB_SIMD
+        SIMD(calcAverages)(s1p, s2p, dstp, src_stride, dst_stride, width, height);
+#else
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x)
+                dstp[x] = (s1p[x] + s2p[x] + 1) / 2;
+            s1p += src_stride;
+            s2p += src_stride;
+            dstp += dst_stride;
+        }
+#endif
+    }
+}
+
+
+static void checkAvgOscCorrelation(const TCombFrame *s1, const TCombFrame *s2, const TCombFrame *s3,
+        const TCombFrame *s4, TCombFrame *dst, const TCombFilter *f)
+{
+    for (int b = f->start; b < f->stop; ++b) {
+        const uint8_t *s1p = s1->data[b];
+        const int stride = s1->stride[b];
+        const int width = f->width[b];
+        const int height = f->height[b];
+        const uint8_t *s2p = s2->data[b];
+        const uint8_t *s3p = s3->data[b];
+        const uint8_t *s4p = s4->data[b];
+        uint8_t *dstp = dst->data[b];
+
+        const int thresh = b == 0 ? f->params.fthreshl : f->params.fthreshc;
+
+#ifdef TCOMB_SIMD
+        SIMD(checkAvgOscCorrelation)(s1p, s2p, s3p, s4p, dstp, stride, width, height, thresh);
+#else
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                if (max4(s1p[x], s2p[x], s3p[x], s4p[x]) -
+                        min4(s1p[x], s2p[x], s3p[x], s4p[x]) >= thresh)
+                    dstp[x] = 0;
+            }
+            s1p += stride;
+            s2p += stride;
+            s3p += stride;
+            s4p += stride;
+            dstp += stride;
+        }
+#endif
+    }
+}
+
+
+// checkAvgOscCorrelation of the averages of the pairs (c[i], p[i]),
+// without storing them.
+static void checkAvgOscCorrelationFields(const TCombFrame c[4], const TCombFrame p[4], TCombFrame *dst, const TCombFilter *f)
+{
+    for (int b = f->start; b < f->stop; ++b) {
+        const uint8_t *cp[4], *pp[4];
+        for (int i = 0; i < 4; ++i) {
+            cp[i] = c[i].data[b];
+            pp[i] = p[i].data[b];
+        }
+        const int src_stride = c[0].stride[b];
+        const int width = f->width[b];
+        const int height = f->height[b];
+        uint8_t *dstp = dst->data[b];
+        const int dst_stride = dst->stride[b];
+
+        const int thresh = b == 0 ? f->params.fthreshl : f->params.fthreshc;
+
+#ifdef TCOMB_SIMD
+        SIMD(checkAvgOscCorrelationFields)(cp[0], pp[0], cp[1], pp[1], cp[2], pp[2], cp[3], pp[3],
+                dstp, src_stride, dst_stride, width, height, thresh);
+#else
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                const int a1 = (cp[0][x] + pp[0][x] + 1) / 2;
+                const int a2 = (cp[1][x] + pp[1][x] + 1) / 2;
+                const int a3 = (cp[2][x] + pp[2][x] + 1) / 2;
+                const int a4 = (cp[3][x] + pp[3][x] + 1) / 2;
+                if (max4(a1, a2, a3, a4) - min4(a1, a2, a3, a4) >= thresh)
+                    dstp[x] = 0;
+            }
+            for (int i = 0; i < 4; ++i) {
+                cp[i] += src_stride;
+                pp[i] += src_stride;
+            }
+            dstp += dst_stride;
+        }
+#endif
+    }
+}
+
+
+static void or3Masks(const TCombFrame *s1, const TCombFrame *s2, const TCombFrame *s3,
+        TCombFrame *dst, const TCombFilter *f)
+{
+    for (int b = 1; b < 3; ++b) {
+        const uint8_t *s1p = s1->data[b];
+        const int stride = s1->stride[b];
+        const int width = f->width[b];
+        const int height = f->height[b];
+        const uint8_t *s2p = s2->data[b];
+        const uint8_t *s3p = s3->data[b];
+        uint8_t *dstp = dst->data[b];
+
+#ifdef TCOMB_SIMD
+        SIMD(or3Masks)(s1p, s2p, s3p, dstp, stride, width, height);
+#else
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                dstp[x] = (s1p[x] | s2p[x] | s3p[x]);
+            }
+            s1p += stride;
+            s2p += stride;
+            s3p += stride;
+            dstp += stride;
+        }
+#endif
+    }
+}
+
+
+static void orAndMasks(const TCombFrame *s1, const TCombFrame *s2, TCombFrame *dst, const TCombFilter *f)
+{
+    const uint8_t *s1p = s1->data[0];
+    const int stride = s1->stride[0];
+    const int height = f->height[0];
+    const int width = f->width[0];
+    const uint8_t *s2p = s2->data[0];
+    uint8_t *dstp = dst->data[0];
+
+#ifdef TCOMB_SIMD
+    SIMD(orAndMasks)(s1p, s2p, dstp, stride, width, height);
+#else
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            dstp[x] |= (s1p[x] & s2p[x]);
+        }
+        s1p += stride;
+        s2p += stride;
+        dstp += stride;
+    }
+#endif
+}
+
+
+static void andMasks(const TCombFrame *s1, const TCombFrame *s2, TCombFrame *dst, const TCombFilter *f)
+{
+    const uint8_t *s1p = s1->data[0];
+    const int stride = s1->stride[0];
+    const int height = f->height[0];
+    const int width = f->width[0];
+    const uint8_t *s2p = s2->data[0];
+    uint8_t *dstp = dst->data[0];
+
+#ifdef TCOMB_SIMD
+    SIMD(andMasks)(s1p, s2p, dstp, stride, width, height);
+#else
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            dstp[x] = (s1p[x] & s2p[x]);
+        }
+        s1p += stride;
+        s2p += stride;
+        dstp += stride;
+    }
+#endif
+}
+
+
+static void or4Masks(const TCombFrame *s1, const TCombFrame *s2, const TCombFrame *s3, const TCombFrame *s4,
+        TCombFrame *dst, const TCombFilter *f)
+{
+    const uint8_t *s1p = s1->data[0];
+    const int stride = s1->stride[0];
+    const int height = f->height[0];
+    const int width = f->width[0];
+    const uint8_t *s2p = s2->data[0];
+    const uint8_t *s3p = s3->data[0];
+    const uint8_t *s4p = s4->data[0];
+    uint8_t *dstp = dst->data[0];
+
+#ifdef TCOMB_SIMD
+    SIMD(or4Masks)(s1p, s2p, s3p, s4p, dstp, stride, width, height);
+#else
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            dstp[x] = (s1p[x] | s2p[x] | s3p[x] | s4p[x]);
+        }
+        s1p += stride;
+        s2p += stride;
+        s3p += stride;
+        s4p += stride;
+        dstp += stride;
+    }
+#endif
+}
+
+
+static int checkSceneChange(const TCombFrame *s1, const TCombFrame *s2, const TCombFilter *f)
+{
+    if (f->params.scthresh < 0.0)
+        return 0;
+
+    const uint8_t *s1p = s1->data[0];
+    const uint8_t *s2p = s2->data[0];
+    const int height = f->height[0];
+    const int width = (f->width[0] / 16) * 16;
+    const int stride = s1->stride[0];
+
+    int64_t diff = 0;
+
+#ifdef TCOMB_SIMD
+    SIMD(checkSceneChange)(s1p, s2p, height, width, stride, &diff);
+#else
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; x += 4) {
+            diff += abs(s1p[x + 0] - s2p[x + 0]);
+            diff += abs(s1p[x + 1] - s2p[x + 1]);
+            diff += abs(s1p[x + 2] - s2p[x + 2]);
+            diff += abs(s1p[x + 3] - s2p[x + 3]);
+        }
+        s1p += stride;
+        s2p += stride;
+    }
+#endif
+
+    if (diff > f->diffmaxsc)
+        return 1;
+
+    return 0;
+}
+
+
+static void VerticalBlur3(const TCombFrame *src, TCombFrame *dst, const TCombFilter *f)
+{
+    const uint8_t *srcp = src->data[0];
+    uint8_t *dstp = dst->data[0];
+    const int src_stride = src->stride[0];
+    const int dst_stride = dst->stride[0];
+    const int width = f->width[0];
+    const int height = f->height[0];
+
+#ifdef TCOMB_SIMD
+    SIMD(verticalBlur3)(srcp, dstp, src_stride, dst_stride, width, height);
+#else
+    const uint8_t *srcpp = srcp - src_stride;
+    const uint8_t *srcpn = srcp + src_stride;
+
+    for (int x = 0; x < width; ++x)
+        dstp[x] = (srcp[x] + srcpn[x] + 1) / 2;
+    srcpp += src_stride;
+    srcp += src_stride;
+    srcpn += src_stride;
+    dstp += dst_stride;
+    for (int y = 1; y < height - 1; ++y) {
+        for (int x = 0; x < width; ++x)
+            dstp[x] = (srcpp[x] + (srcp[x] * 2) + srcpn[x] + 2) / 4;
+        srcpp += src_stride;
+        srcp += src_stride;
+        srcpn += src_stride;
+        dstp += dst_stride;
+    }
+    for (int x = 0; x < width; ++x)
+        dstp[x] = (srcpp[x] + srcp[x] + 1) / 2;
+#endif
+}
+
+
+static inline void horizontalBlur3_c( const uint8_t *srcp, uint8_t *dstp, int src_stride, int dst_stride, int width, int height) {
+    for (int y = 0; y < height; ++y) {
+        dstp[0] = (srcp[0] + srcp[1] + 1) / 2;
+
+        for (int x = 1; x < width - 1; ++x)
+            dstp[x] = (srcp[x - 1] + (srcp[x] * 2) + srcp[x + 1] + 2) / 4;
+
+        dstp[width - 1] = (srcp[width - 2] + srcp[width - 1] + 1) / 2;
+
+        srcp += src_stride;
+        dstp += dst_stride;
+    }
+}
+
+
+static void HorizontalBlur3(const TCombFrame *src, TCombFrame *dst, const TCombFilter *f)
+{
+    const uint8_t *srcp = src->data[0];
+    uint8_t *dstp = dst->data[0];
+    const int src_stride = src->stride[0];
+    const int dst_stride = dst->stride[0];
+    const int width = f->width[0];
+    const int height = f->height[0];
+
+#ifdef TCOMB_SIMD
+    if (width >= 16) {
+        const int widtha = (width / 16) * 16;
+
+        SIMD(horizontalBlur3)(srcp + 16, dstp + 16, src_stride, dst_stride, widtha - 32, height);
+
+        for (int y = 0; y < height; y++) {
+            dstp[0] = (srcp[0] + srcp[1] + 1) / 2;
+
+            for (int x = 1; x < 16; x++)
+                dstp[x] = (srcp[x - 1] + (srcp[x] * 2) + srcp[x + 1] + 2) / 4;
+
+            for (int x = widtha - 16; x < width - 1; x++)
+                dstp[x] = (srcp[x - 1] + (srcp[x] * 2) + srcp[x + 1] + 2) / 4;
+
+            dstp[width - 1] = (srcp[width - 2] + srcp[width - 1] + 1) / 2;
+
+            srcp += src_stride;
+            dstp += dst_stride;
+        }
+    } else {
+        horizontalBlur3_c(srcp, dstp, src_stride, dst_stride, width, height);
+    }
+#else
+    horizontalBlur3_c(srcp, dstp, src_stride, dst_stride, width, height);
+#endif
+}
+
+
+static inline void horizontalBlur6_c( const uint8_t *srcp, uint8_t *dstp, int src_stride, int dst_stride, int width, int height) {
+    for (int y = 0; y < height; ++y) {
+        dstp[0] = (srcp[0] * 6 + (srcp[1] * 8) + (srcp[2] * 2) + 8) / 16;
+        dstp[1] = (((srcp[0] + srcp[2]) * 4) + srcp[1] * 6 + (srcp[3] * 2) + 8) / 16;
+
+        for (int x = 2; x < width - 2; ++x)
+            dstp[x] = (srcp[x - 2] + ((srcp[x - 1] + srcp[x + 1]) * 4) + srcp[x] * 6 + srcp[x + 2] + 8) / 16;
+
+        dstp[width - 2] = ((srcp[width - 4] * 2) + ((srcp[width - 3] + srcp[width - 1]) * 4) + srcp[width - 2] * 6 + 8) / 16;
+        dstp[width - 1] = ((srcp[width - 3] * 2) + (srcp[width - 2] * 8) + srcp[width - 1] * 6 + 8) / 16;
+
+        srcp += src_stride;
+        dstp += dst_stride;
+    }
+}
+
+
+static void HorizontalBlur6(const TCombFrame *src, TCombFrame *dst, const TCombFilter *f)
+{
+    const uint8_t *srcp = src->data[0];
+    uint8_t *dstp = dst->data[0];
+    const int src_stride = src->stride[0];
+    const int dst_stride = dst->stride[0];
+    const int width = f->width[0];
+    const int height = f->height[0];
+
+#ifdef TCOMB_SIMD
+    if (width >= 16) {
+        const int widtha = (width / 16) * 16;
+
+        SIMD(horizontalBlur6)(srcp + 16, dstp + 16, src_stride, dst_stride, widtha - 32, height);
+
+        for (int y = 0; y < height; y++) {
+            dstp[0] = (srcp[0] * 6 + (srcp[1] * 8) + (srcp[2] * 2) + 8) / 16;
+            dstp[1] = (((srcp[0] + srcp[2]) * 4) + srcp[1] * 6 + (srcp[3] * 2) + 8) / 16;
+
+            for (int x = 2; x < 16; x++)
+                dstp[x] = (srcp[x - 2] + ((srcp[x - 1] + srcp[x + 1]) * 4) + srcp[x] * 6 + srcp[x + 2] + 8) / 16;
+
+            for (int x = widtha - 16; x < width - 2; x++)
+                dstp[x] = (srcp[x - 2] + ((srcp[x - 1] + srcp[x + 1]) * 4) + srcp[x] * 6 + srcp[x + 2] + 8) / 16;
+
+            dstp[width - 2] = ((srcp[width - 4] * 2) + ((srcp[width - 3] + srcp[width - 1]) * 4) + srcp[width - 2] * 6 + 8) / 16;
+            dstp[width - 1] = ((srcp[width - 3] * 2) + (srcp[width - 2] * 8) + srcp[width - 1] * 6 + 8) / 16;
+
+            srcp += src_stride;
+            dstp += dst_stride;
+        }
+    } else {
+        horizontalBlur6_c(srcp, dstp, src_stride, dst_stride, width, height);
+    }
+#else
+    horizontalBlur6_c(srcp, dstp, src_stride, dst_stride, width, height);
+#endif
+}
+
+
+int tcombFieldsEqual(const TCombFilter *filter, const TCombFrame *a, const TCombFrame *b)
+{
+    const TCombFrame av = tcombActiveView(filter, a);
+    const TCombFrame bv = tcombActiveView(filter, b);
+
+    for (int p = filter->start; p < filter->stop; ++p) {
+        if (av.data[p] == bv.data[p] && av.stride[p] == bv.stride[p])
+            continue;
+
+        const uint8_t *ap = av.data[p];
+        const uint8_t *bp = bv.data[p];
+
+        for (int y = 0; y < filter->height[p]; ++y) {
+            if (memcmp(ap, bp, filter->width[p]))
+                return 0;
+            ap += av.stride[p];
+            bp += bv.stride[p];
+        }
+    }
+
+    return 1;
+}
+
+
+int tcombBlurCount(const TCombFilter *filter)
+{
+    return filter->params.preset == PresetFast ? 2 : 6;
+}
+
+
+int tcombStage1(const TCombFilter *filter, const TCombFrame *prev, const TCombFrame *cur, TCombFrame *blurred, TCombFrame *tmp)
+{
+    const TCombFrame p = tcombActiveView(filter, prev);
+    const TCombFrame c = tcombActiveView(filter, cur);
+
+    const int sc = checkSceneChange(&c, &p, filter);
+
+    if (tcombFilterProcessesLuma(filter) && blurred) {
+        TCombFrame bl[6];
+        activeViews(filter, blurred, bl, tcombBlurCount(filter));
+
+        if (filter->params.preset == PresetFast) {
+            TCombFrame t = tcombActiveView(filter, tmp);
+
+            VerticalBlur3(&c, &bl[0], filter);
+            VerticalBlur3(&bl[0], &t, filter);
+            HorizontalBlur6(&t, &bl[1], filter);
+        } else {
+            HorizontalBlur3(&c, &bl[0], filter);
+            VerticalBlur3(&c, &bl[1], filter);
+            HorizontalBlur3(&bl[1], &bl[2], filter);
+            HorizontalBlur6(&c, &bl[3], filter);
+            VerticalBlur3(&bl[1], &bl[4], filter);
+            HorizontalBlur6(&bl[4], &bl[5], filter);
+        }
+    }
+
+    return sc;
+}
+
+
+void tcombStage2(const TCombFilter *filter, const TCombFrame *prev, const TCombFrame *cur,
+        const TCombFrame *prev_blurred, const TCombFrame *cur_blurred,
+        TCombFrame *msk1, TCombFrame *avg)
+{
+    const TCombFrame p = tcombActiveView(filter, prev);
+    const TCombFrame c = tcombActiveView(filter, cur);
+    TCombFrame a = tcombActiveView(filter, avg);
+
+    if (tcombFilterProcessesLuma(filter)) {
+        const int last = tcombBlurCount(filter) - 1;
+        TCombFrame pb[6], cb[6];
+        TCombFrame m = tcombActiveView(filter, msk1);
+
+        activeViews(filter, prev_blurred, pb, last + 1);
+        activeViews(filter, cur_blurred, cb, last + 1);
+
+        absDiff(&p, &c, &m, filter);
+        for (int i = 0; i < last; ++i)
+            absDiffAndMinMask(&pb[i], &cb[i], &m, filter);
+        absDiffAndMinMaskThresh(&pb[last], &cb[last], &m, filter);
+    }
+
+    calcAverages(&c, &p, &a, filter);
+}
+
+
+// Blur number level of src, as Stage 1 makes it, in one of two scratch
+// planes. The levels must be made in order, since the later ones start
+// from the earlier ones left in a and b.
+static TCombFrame *lowMemBlur(const TCombFilter *f, int level, const TCombFrame *src, TCombFrame *a, TCombFrame *b)
+{
+    if (f->params.preset == PresetFast) {
+        if (level == 0) {
+            VerticalBlur3(src, a, f);
+        } else {
+            VerticalBlur3(a, b, f);
+            HorizontalBlur6(b, a, f);
+        }
+        return a;
+    }
+
+    switch (level) {
+    case 0:
+        HorizontalBlur3(src, b, f);
+        return b;
+    case 1:
+        VerticalBlur3(src, a, f);
+        return a;
+    case 2:
+        HorizontalBlur3(a, b, f);
+        return b;
+    case 3:
+        HorizontalBlur6(src, b, f);
+        return b;
+    case 4:
+        VerticalBlur3(a, b, f);
+        return b;
+    default:
+        HorizontalBlur6(b, a, f);
+        return a;
+    }
+}
+
+
+void tcombStage2LowMem(const TCombFilter *filter, const TCombFrame *prev, const TCombFrame *cur,
+        TCombFrame *msk1, TCombFrame scratch[4])
+{
+    if (!tcombFilterProcessesLuma(filter))
+        return;
+
+    const TCombFrame p = tcombActiveView(filter, prev);
+    const TCombFrame c = tcombActiveView(filter, cur);
+    TCombFrame m = tcombActiveView(filter, msk1);
+    TCombFrame s[4];
+
+    activeViews(filter, scratch, s, 4);
+
+    const int last = tcombBlurCount(filter) - 1;
+
+    absDiff(&p, &c, &m, filter);
+    for (int i = 0; i <= last; ++i) {
+        const TCombFrame *pb = lowMemBlur(filter, i, &p, &s[0], &s[1]);
+        const TCombFrame *cb = lowMemBlur(filter, i, &c, &s[2], &s[3]);
+
+        if (i < last)
+            absDiffAndMinMask(pb, cb, &m, filter);
+        else
+            absDiffAndMinMaskThresh(pb, cb, &m, filter);
+    }
+}
+
+
+void tcombStage2Duplicate(const TCombFilter *filter, const TCombFrame *cur, TCombFrame *msk1, TCombFrame *avg)
+{
+    const TCombFrame c = tcombActiveView(filter, cur);
+
+    // Every difference is 0, which is below fthreshl. The SIMD kernels
+    // read masks in blocks of 16 pixels, so the whole block is filled.
+    if (tcombFilterProcessesLuma(filter)) {
+        const TCombFrame m = tcombActiveView(filter, msk1);
+        const int width = (filter->width[0] + 15) & ~15;
+
+        for (int y = 0; y < filter->height[0]; ++y)
+            memset(m.data[0] + y * m.stride[0], 0xFF, width);
+    }
+
+    if (avg) {
+        const TCombFrame a = tcombActiveView(filter, avg);
+
+        for (int b = filter->start; b < filter->stop; ++b)
+            bitblt(a.data[b], a.stride[b], c.data[b], c.stride[b], filter->width[b], filter->height[b]);
+    }
+}
+
+
+void tcombStage3(const TCombFilter *filter, const TCombFrame src[5], const TCombFrame avg[4], TCombFrame *omsk)
+{
+    TCombFrame s[5], a[4];
+    TCombFrame o = tcombActiveView(filter, omsk);
+
+    activeViews(filter, src, s, 5);
+    activeViews(filter, avg, a, 4);
+
+    checkOscillation5(&s[0], &s[1], &s[2], &s[3], &s[4], &o, filter);
+
+    checkAvgOscCorrelation(&a[0], &a[1], &a[2], &a[3], &o, filter);
+}
+
+
+void tcombStage3LowMem(const TCombFilter *filter, const TCombFrame src[5],
+        const TCombFrame avg_cur[4], const TCombFrame avg_prev[4], TCombFrame *omsk)
+{
+    TCombFrame s[5], c[4], p[4];
+    TCombFrame o = tcombActiveView(filter, omsk);
+
+    activeViews(filter, src, s, 5);
+    activeViews(filter, avg_cur, c, 4);
+    activeViews(filter, avg_prev, p, 4);
+
+    checkOscillation5(&s[0], &s[1], &s[2], &s[3], &s[4], &o, filter);
+
+    checkAvgOscCorrelationFields(c, p, &o, filter);
+}
+
+
+void tcombStage4Pair(const TCombFilter *filter, const TCombFrame *omsk_a, const TCombFrame *omsk_b, TCombFrame *pair)
+{
+    const TCombFrame a = tcombActiveView(filter, omsk_a);
+    const TCombFrame b = tcombActiveView(filter, omsk_b);
+    TCombFrame p = tcombActiveView(filter, pair);
+
+    andMasks(&a, &b, &p, filter);
+}
+
+
+void tcombStage4(const TCombFilter *filter, const TCombFrame *prev2, const TCombFrame *cur,
+        const int sc[2], const TCombFrame omsk[5], const TCombFrame *pairs, const TCombFrame msk1[2],
+        TCombFrame *tmp, TCombFrame *msk2)
+{
+    TCombFrame m2 = tcombActiveView(filter, msk2);
+
+    if (sc[0] || sc[1]) {
+        for (int b = filter->start; b < filter->stop; ++b)
+            for (int y = 0; y < filter->height[b]; ++y)
+                memset(m2.data[b] + y * m2.stride[b], 0, filter->width[b]);
+        return;
+    }
+
+    const TCombFrame p2 = tcombActiveView(filter, prev2);
+    const TCombFrame c = tcombActiveView(filter, cur);
+    TCombFrame t = tcombActiveView(filter, tmp);
+    TCombFrame o[5], m1[2];
+
+    activeViews(filter, omsk, o, 5);
+
+    if (tcombFilterProcessesLuma(filter)) {
+        activeViews(filter, msk1, m1, 2);
+
+        if (pairs) {
+            TCombFrame pr[4];
+            activeViews(filter, pairs, pr, 4);
+
+            or4Masks(&pr[0], &pr[1], &pr[2], &pr[3], &t, filter);
+        } else {
+            andMasks(&o[0], &o[1], &t, filter);
+
+            for (int i = 1; i < 4; i++)
+                orAndMasks(&o[i], &o[i + 1], &t, filter);
+        }
+
+        andNeighborsInPlace(&t, filter);
+
+        orAndMasks(&m1[0], &m1[1], &t, filter);
+    }
+    if (tcombFilterProcessesChroma(filter)) {
+        or3Masks(&o[1], &o[2], &o[3], &t, filter);
+    }
+    buildFinalMask(&p2, &c, &t, &m2, filter);
+}
+
+
+void tcombMaskCount(const TCombFilter *filter, const TCombFrame *msk2, int64_t counts[3])
+{
+    const TCombFrame m = tcombActiveView(filter, msk2);
+
+    for (int b = 0; b < 3; ++b) {
+        counts[b] = 0;
+
+        if (b < filter->start || b >= filter->stop)
+            continue;
+
+        const uint8_t *mp = m.data[b];
+
+        for (int y = 0; y < filter->height[b]; ++y) {
+            int row = 0;
+            for (int x = 0; x < filter->width[b]; ++x)
+                row += mp[x] != 0;
+            counts[b] += row;
+            mp += m.stride[b];
+        }
+    }
+}
+
+
+static void clearPlane(const TCombFilter *filter, TCombFrame *dst, int b)
+{
+    for (int y = 0; y < filter->fieldHeight[b]; ++y)
+        memset(dst->data[b] + y * dst->stride[b], 0, filter->fieldWidth[b]);
+}
+
+
+static void copyOrClearPlane(const TCombFilter *filter, const TCombFrame *src, TCombFrame *dst, int b)
+{
+    if (!filter->params.map)
+        bitblt(dst->data[b], dst->stride[b], src->data[b], src->stride[b], filter->fieldWidth[b], filter->fieldHeight[b]);
+    else
+        clearPlane(filter, dst, b);
+}
+
+
+void tcombStage5(const TCombFilter *filter, const TCombFrame src[5], const TCombFrame msk2[3],
+        TCombFrame *dst, TCombFrame *map, TCombFrame *min, TCombFrame *max, TCombFrame *pad)
+{
+    if (filter->params.map)
+        map = NULL;
+
+    // Whatever is outside the processed rectangle is copied through, and
+    // the filtered pixels are written over the copy.
+    for (int b = filter->start; b < filter->stop; ++b)
+        copyOrClearPlane(filter, &src[2], dst, b);
+
+    if (map)
+        for (int b = 0; b < filter->numPlanes; ++b)
+            clearPlane(filter, map, b);
+
+    TCombFrame s[5], m[3];
+    TCombFrame mp = { { NULL }, { 0 } };
+    if (map)
+        mp = tcombActiveView(filter, map);
+    TCombFrame d = tcombActiveView(filter, dst);
+    TCombFrame mn = tcombActiveView(filter, min);
+    TCombFrame mx = tcombActiveView(filter, max);
+    TCombFrame pd = tcombActiveView(filter, pad);
+
+    activeViews(filter, src, s, 5);
+    activeViews(filter, msk2, m, 3);
+
+    buildFinalFrame(&s[0], &s[1], &s[2], &s[3], &s[4],
+            &m[0], &m[1], &m[2],
+            &d, map ? &mp : NULL, &mn, &mx, &pd, filter);
+}
+
+
+void tcombStage5Unprocessed(const TCombFilter *filter, const TCombFrame *src, TCombFrame *dst)
+{
+    for (int b = 0; b < filter->numPlanes; ++b)
+        if (b < filter->start || b >= filter->stop)
+            copyOrClearPlane(filter, src, dst, b);
+}
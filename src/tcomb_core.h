@@ -0,0 +1,344 @@
+/*
+ **   TComb core library: the filter without any VapourSynth dependency.
+ **
+ **   Copyright (C) 2005-2006 Kevin Stone
+ **
+ **   VapourSynth port by dubhater
+ **
+ **   This program is free software; you can redistribute it and/or modify
+ **   it under the terms of the GNU General Public License as published by
+ **   the Free Software Foundation; either version 2 of the License, or
+ **   (at your option) any later version.
+ **
+ **   This program is distributed in the hope that it will be useful,
+ **   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ **   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ **   GNU General Public License for more details.
+ **
+ **   You should have received a copy of the GNU General Public License
+ **   along with this program; if not, write to the Free Software
+ **   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef TCOMB_CORE_H
+#define TCOMB_CORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+// TComb works on the fields of 8 bit Gray or YUV material, top field first.
+// Field n's same parity neighbours are n - 2 and n + 2.
+//
+// All plane pointers handed to the library must be 16 byte aligned, all
+// strides must be multiples of 16, and every row must be readable up to
+// the width rounded up to a multiple of 16.
+#define TCOMB_ALIGNMENT 16
+
+
+enum TCombModes {
+    LumaOnly = 0,
+    ChromaOnly,
+    LumaAndChroma
+};
+
+
+// How many blurred versions of the luma the motion mask msk1 looks at.
+enum TCombPresets {
+    PresetFull = 0,     // six
+    PresetFast          // two: the vertical blur and the strongest one
+};
+
+
+typedef struct TCombParams {
+    int mode;
+    int fthreshl;
+    int fthreshc;
+    int othreshl;
+    int othreshc;
+    int map;
+    double scthresh;
+    int preset;
+
+    // Luma pixels at each edge of the field that are copied through
+    // without being looked at, e.g. letterbox bars. tcombFilterInit moves
+    // the edges outwards as needed to keep the planes aligned.
+    int left;
+    int top;
+    int right;
+    int bottom;
+
+    // Don't keep the blurs and averages between stages: Stage 2 blurs the
+    // fields itself and Stage 3 averages them on the fly. The output is
+    // the same; only the intermediates are smaller.
+    int lowmem;
+} TCombParams;
+
+
+// Dimensions of one field (not one frame).
+typedef struct TCombFormat {
+    int width;
+    int height;
+    int numPlanes;
+    int subSamplingW;
+    int subSamplingH;
+} TCombFormat;
+
+
+typedef struct TCombFilter {
+    TCombParams params;
+
+    int numPlanes;
+
+    // The processed rectangle of each plane.
+    int left[3];
+    int top[3];
+    int width[3];
+    int height[3];
+
+    // The whole field.
+    int fieldWidth[3];
+    int fieldHeight[3];
+
+    int start, stop;
+    int64_t diffmaxsc;
+} TCombFilter;
+
+
+// A view of one field or intermediate. The library never allocates or frees
+// the memory behind a view.
+typedef struct TCombFrame {
+    uint8_t *data[3];
+    int stride[3];
+} TCombFrame;
+
+
+void tcombParamsDefault(TCombParams *params);
+
+// Returns NULL if the parameters are valid, otherwise an error message.
+const char *tcombParamsCheck(const TCombParams *params);
+
+// Returns NULL on success, otherwise an error message.
+const char *tcombFilterInit(TCombFilter *filter, const TCombParams *params, const TCombFormat *format);
+
+int tcombFilterProcessesLuma(const TCombFilter *filter);
+int tcombFilterProcessesChroma(const TCombFilter *filter);
+
+// The part of a field or intermediate inside the processed rectangle. The
+// stages call this themselves; views are always passed whole.
+TCombFrame tcombActiveView(const TCombFilter *filter, const TCombFrame *frame);
+
+// Measures the black bars around a picture: the number of rows and columns
+// at each edge whose luma is no brighter than TCOMB_BLACK. Returns 0 if the
+// whole picture is black.
+#define TCOMB_BLACK 32
+int tcombFindBorders(const uint8_t *luma, int stride, int width, int height, int *left, int *top, int *right, int *bottom);
+
+
+// The five stages of the filter, computed for field n. Arrays of neighbours
+// are ordered from the oldest to the newest field unless noted otherwise.
+//
+// The number of blurred versions of the luma made by Stage 1: 6, or 2 with
+// PresetFast.
+int tcombBlurCount(const TCombFilter *filter);
+
+// Stage 1: scene change flag between n - 2 and n, and the blurred versions
+// of field n's luma (only when luma is processed and blurred is not NULL).
+// blurred holds tcombBlurCount(filter) frames. tmp is scratch space for the
+// luma, needed only with PresetFast.
+int tcombStage1(const TCombFilter *filter, const TCombFrame *prev, const TCombFrame *cur, TCombFrame *blurred, TCombFrame *tmp);
+
+// Stage 2: luma motion mask msk1 (only when luma is processed) and the
+// average of fields n - 2 and n.
+void tcombStage2(const TCombFilter *filter, const TCombFrame *prev, const TCombFrame *cur,
+        const TCombFrame *prev_blurred, const TCombFrame *cur_blurred,
+        TCombFrame *msk1, TCombFrame *avg);
+
+// Stage 2 with lowmem: only msk1 (when luma is processed), without the
+// blurs of Stage 1. scratch holds four luma planes the size of a field.
+void tcombStage2LowMem(const TCombFilter *filter, const TCombFrame *prev, const TCombFrame *cur,
+        TCombFrame *msk1, TCombFrame scratch[4]);
+
+// Duplicate fields.
+//
+// Held frames and still pictures produce fields that are identical to field
+// n - 2. For such a field, Stage 2 doesn't need the blurs: the average is the
+// field itself and msk1 is constant. The blurs of n
+// are then only needed if field n + 2 is different. In the same way, if
+// fields n - 4 ... n + 4 are all identical and map is off, Stage 5's output
+// is field n itself, whatever msk2 contains.
+
+// Returns 1 if a and b are identical in the planes the filter processes.
+int tcombFieldsEqual(const TCombFilter *filter, const TCombFrame *a, const TCombFrame *b);
+
+// Stage 2 for a field identical to n - 2. avg may be NULL when the caller
+// uses the field itself as the average.
+void tcombStage2Duplicate(const TCombFilter *filter, const TCombFrame *cur, TCombFrame *msk1, TCombFrame *avg);
+
+// Stage 3: oscillation mask omsk. src holds fields n + 8, n + 6, n + 4,
+// n + 2, n and avg holds the averages of n + 6, n + 4, n + 2, n.
+void tcombStage3(const TCombFilter *filter, const TCombFrame src[5], const TCombFrame avg[4], TCombFrame *omsk);
+
+// Stage 3 with lowmem: the averages aren't given but made from the fields
+// they average. avg[i] of tcombStage3 is the average of avg_cur[i] and
+// avg_prev[i], i.e. of field n + 6 - 2 * i and the field before it.
+void tcombStage3LowMem(const TCombFilter *filter, const TCombFrame src[5],
+        const TCombFrame avg_cur[4], const TCombFrame avg_prev[4], TCombFrame *omsk);
+
+// Stage 4: final mask msk2. prev2 is field n - 4, sc and msk1 belong to
+// n - 2 and n, omsk to n - 2 ... n + 6. tmp is scratch space.
+//
+// For the luma, Stage 4 combines the four pairs of neighbouring omsk with
+// AND. Field n + 2 uses three of the pairs of field n, so callers that go
+// through the fields in order can keep them: pairs, if not NULL, holds
+// tcombStage4Pair of omsk[i] and omsk[i + 1] for i = 0 ... 3. Otherwise
+// they are computed from omsk.
+void tcombStage4(const TCombFilter *filter, const TCombFrame *prev2, const TCombFrame *cur,
+        const int sc[2], const TCombFrame omsk[5], const TCombFrame *pairs, const TCombFrame msk1[2],
+        TCombFrame *tmp, TCombFrame *msk2);
+
+// The luma of omsk_a AND omsk_b. pair needs the luma plane only.
+void tcombStage4Pair(const TCombFilter *filter, const TCombFrame *omsk_a, const TCombFrame *omsk_b, TCombFrame *pair);
+
+// The number of pixels set in each plane of msk2, inside the processed
+// rectangle. These are the pixels Stage 5 would filter. Planes the filter
+// doesn't process count 0.
+void tcombMaskCount(const TCombFilter *filter, const TCombFrame *msk2, int64_t counts[3]);
+
+// Stage 5: output field. src holds fields n - 4 ... n + 4 and msk2 belongs
+// to n, n + 2, n + 4. min and max are scratch space the size of a field,
+// pad is scratch space two pixels larger in each direction. Only the planes
+// the filter processes are written.
+//
+// If map is not NULL and the map parameter is off, the map is written to it
+// as well, in the same pass and including the planes that aren't processed.
+void tcombStage5(const TCombFilter *filter, const TCombFrame src[5], const TCombFrame msk2[3],
+        TCombFrame *dst, TCombFrame *map, TCombFrame *min, TCombFrame *max, TCombFrame *pad);
+
+// The rest of Stage 5's output: copies the planes the filter doesn't process
+// from field n, or clears them when map is on. Callers that can make dst
+// share those planes with field n don't need it.
+void tcombStage5Unprocessed(const TCombFilter *filter, const TCombFrame *src, TCombFrame *dst);
+
+
+// Mask files.
+//
+// A mask file holds msk2 and the scene change and duplicate flags of every
+// field of a clip, so that later runs over the same clip with the same
+// parameters (map excepted) only have to run Stage 5. Each field also gets a
+// hash of its pixels, so that a file used with the wrong clip can be caught.
+
+enum TCombMaskFlags {
+    TCombMaskSceneChange = 1,
+    TCombMaskDuplicate = 2
+};
+
+uint64_t tcombFieldHash(const TCombFilter *filter, const TCombFrame *field);
+
+typedef struct TCombMaskWriter TCombMaskWriter;
+
+// Returns NULL when out of memory.
+TCombMaskWriter *tcombMaskWriterCreate(const TCombFilter *filter, int num_fields);
+
+// Can be called from several threads at once. If a field is added more than
+// once, the first copy is kept. Returns 0 when out of memory.
+int tcombMaskWriterAdd(TCombMaskWriter *writer, int n, const TCombFrame *msk2, int flags, uint64_t hash);
+
+// The number of different fields added so far.
+int tcombMaskWriterCount(const TCombMaskWriter *writer);
+
+// Fails unless every field was added. Returns NULL on success, otherwise an
+// error message.
+const char *tcombMaskWriterSave(const TCombMaskWriter *writer, const char *path);
+
+void tcombMaskWriterFree(TCombMaskWriter *writer);
+
+typedef struct TCombMaskReader TCombMaskReader;
+
+// Maps the file into memory and checks that it was made from a clip with the
+// same format and length, and with the same parameters. Returns NULL and
+// fills error on failure.
+TCombMaskReader *tcombMaskReaderOpen(const char *path, const TCombFilter *filter, int num_fields, char *error, size_t error_size);
+
+int tcombMaskReaderFlags(const TCombMaskReader *reader, int n);
+uint64_t tcombMaskReaderHash(const TCombMaskReader *reader, int n);
+
+// Writes field n's msk2. Returns 0 if the stored mask is corrupt.
+int tcombMaskReaderDecode(const TCombMaskReader *reader, int n, TCombFrame *msk2);
+
+void tcombMaskReaderClose(TCombMaskReader *reader);
+
+
+// Streaming interface.
+//
+// Fields are pushed in display order (top field first) and come back out of
+// tcombStreamPullField in the same order, after their output has been
+// written and the library no longer reads their source. Both the source and
+// the destination buffers belong to the caller and must stay valid until the
+// field is pulled. All fields pushed to one stream must use the same source
+// strides.
+//
+// A field whose dst[0] is NULL only serves as context for its neighbours:
+// it goes through the analysis, but its output isn't made.
+
+typedef struct TCombField {
+    const uint8_t *src[3];
+    int srcStride[3];
+    uint8_t *dst[3];
+    int dstStride[3];
+    void *userData;
+} TCombField;
+
+typedef struct TCombStream TCombStream;
+
+// Runs task(taskData, i) for every i in [0, count). The calls are
+// independent of each other and may run concurrently.
+typedef void (*TCombParallelFor)(void *executorData, int count, void (*task)(void *taskData, int index), void *taskData);
+
+enum TCombStreamStatus {
+    TCombStreamOk = 0,
+    TCombStreamFull = -1,       // pull fields before pushing more
+    TCombStreamBadField = -2,   // misaligned pointers or mismatched strides
+    TCombStreamFinished = -3,   // tcombStreamFinish was already called
+    TCombStreamNoMemory = -4
+};
+
+// Latency of the stream in fields: field n can be pulled once field
+// n + TCOMB_STREAM_DELAY has been pushed, or after tcombStreamFinish.
+#define TCOMB_STREAM_DELAY 26
+
+// The output of field n depends on the source fields from
+// n - TCOMB_STREAM_HALO_BEFORE to n + TCOMB_STREAM_HALO_AFTER only, so a
+// range of fields can be made by pushing just those around it.
+#define TCOMB_STREAM_HALO_BEFORE 6
+#define TCOMB_STREAM_HALO_AFTER 18
+
+// The number of fields that can be in flight between push and pull.
+#define TCOMB_STREAM_DEPTH 64
+
+// Returns NULL and fills error on failure.
+TCombStream *tcombStreamCreate(const TCombParams *params, const TCombFormat *format, char *error, size_t error_size);
+
+// By default the stages of a step run one after another on the calling thread.
+void tcombStreamSetExecutor(TCombStream *stream, TCombParallelFor parallel_for, void *executor_data);
+
+int tcombStreamPushField(TCombStream *stream, const TCombField *field);
+
+// Signals the end of the input and processes the remaining fields.
+int tcombStreamFinish(TCombStream *stream);
+
+// Returns 1 and stores the pushed field's userData if a field is ready, 0 otherwise.
+int tcombStreamPullField(TCombStream *stream, void **user_data);
+
+void tcombStreamFree(TCombStream *stream);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TCOMB_CORE_H
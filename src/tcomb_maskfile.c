@@ -0,0 +1,549 @@
+/*
+ **   TComb mask files: msk2 of every field, stored so that later runs over
+ **   the same clip only have to run Stage 5.
+ **
+ **   Copyright (C) 2005-2006 Kevin Stone
+ **
+ **   VapourSynth port by dubhater
+ **
+ **   This program is free software; you can redistribute it and/or modify
+ **   it under the terms of the GNU General Public License as published by
+ **   the Free Software Foundation; either version 2 of the License, or
+ **   (at your option) any later version.
+ **
+ **   This program is distributed in the hope that it will be useful,
+ **   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ **   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ **   GNU General Public License for more details.
+ **
+ **   You should have received a copy of the GNU General Public License
+ **   along with this program; if not, write to the Free Software
+ **   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "tcomb_core.h"
+
+
+// File layout, in native byte order:
+//
+//   MaskFileHeader
+//   MaskFileIndex[num_fields]
+//   the masks of the fields
+//
+// Each field's mask holds the processed planes one after another. A plane is
+// a sequence of run lengths (LEB128), alternating between 0x00 and 0xFF and
+// starting with 0x00, that add up to width * height.
+
+#define MASK_FILE_MAGIC "TCombMsk"
+#define MASK_FILE_VERSION 1
+
+typedef struct MaskFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+
+    int32_t num_fields;
+    int32_t num_planes;
+    int32_t width[3];
+    int32_t height[3];
+
+    // The processed rectangle of the luma.
+    int32_t left;
+    int32_t top;
+    int32_t active_width;
+    int32_t active_height;
+
+    // The parameters that affect msk2. map doesn't.
+    int32_t mode;
+    int32_t fthreshl;
+    int32_t fthreshc;
+    int32_t othreshl;
+    int32_t othreshc;
+    int32_t preset;
+    double scthresh;
+} MaskFileHeader;
+
+typedef struct MaskFileIndex {
+    uint64_t offset;
+    uint64_t hash;
+    uint32_t size;
+    uint32_t flags;
+} MaskFileIndex;
+
+
+uint64_t tcombFieldHash(const TCombFilter *filter, const TCombFrame *field)
+{
+    uint64_t hash = 0xCBF29CE484222325ULL;
+
+    for (int b = 0; b < filter->numPlanes; ++b) {
+        const uint8_t *srcp = field->data[b];
+
+        for (int y = 0; y < filter->fieldHeight[b]; ++y) {
+            int x = 0;
+
+            for (; x + 8 <= filter->fieldWidth[b]; x += 8) {
+                uint64_t v;
+                memcpy(&v, srcp + x, 8);
+                hash = (hash ^ v) * 0x100000001B3ULL;
+                hash ^= hash >> 29;
+            }
+
+            for (; x < filter->fieldWidth[b]; ++x)
+                hash = (hash ^ srcp[x]) * 0x100000001B3ULL;
+
+            srcp += field->stride[b];
+        }
+    }
+
+    return hash;
+}
+
+
+static void headerFill(MaskFileHeader *header, const TCombFilter *filter, int num_fields)
+{
+    memset(header, 0, sizeof(*header));
+
+    memcpy(header->magic, MASK_FILE_MAGIC, sizeof(header->magic));
+    header->version = MASK_FILE_VERSION;
+    header->header_size = sizeof(MaskFileHeader);
+
+    header->num_fields = num_fields;
+    header->num_planes = filter->numPlanes;
+    for (int b = 0; b < filter->numPlanes; ++b) {
+        header->width[b] = filter->fieldWidth[b];
+        header->height[b] = filter->fieldHeight[b];
+    }
+
+    header->left = filter->left[0];
+    header->top = filter->top[0];
+    header->active_width = filter->width[0];
+    header->active_height = filter->height[0];
+
+    header->mode = filter->params.mode;
+    header->fthreshl = filter->params.fthreshl;
+    header->fthreshc = filter->params.fthreshc;
+    header->othreshl = filter->params.othreshl;
+    header->othreshc = filter->params.othreshc;
+    header->preset = filter->params.preset;
+    header->scthresh = filter->params.scthresh;
+}
+
+
+typedef struct MaskRecord {
+    uint64_t hash;
+    uint32_t size;
+    uint32_t flags;
+    uint8_t data[];
+} MaskRecord;
+
+
+struct TCombMaskWriter {
+    TCombFilter filter;
+    int num_fields;
+    int count;
+    MaskRecord **records;
+};
+
+
+TCombMaskWriter *tcombMaskWriterCreate(const TCombFilter *filter, int num_fields)
+{
+    TCombMaskWriter *writer = malloc(sizeof(TCombMaskWriter));
+    if (!writer)
+        return NULL;
+
+    writer->filter = *filter;
+    writer->num_fields = num_fields;
+    writer->count = 0;
+    writer->records = calloc(num_fields, sizeof(MaskRecord *));
+    if (!writer->records) {
+        free(writer);
+        return NULL;
+    }
+
+    return writer;
+}
+
+
+static uint8_t *putRun(uint8_t *dstp, uint32_t run)
+{
+    while (run >= 0x80) {
+        *dstp++ = (uint8_t)(run | 0x80);
+        run >>= 7;
+    }
+    *dstp++ = (uint8_t)run;
+
+    return dstp;
+}
+
+
+int tcombMaskWriterAdd(TCombMaskWriter *writer, int n, const TCombFrame *msk2, int flags, uint64_t hash)
+{
+    const TCombFilter *f = &writer->filter;
+    const TCombFrame active = tcombActiveView(f, msk2);
+
+    if (n < 0 || n >= writer->num_fields)
+        return 0;
+
+    if (__atomic_load_n(&writer->records[n], __ATOMIC_ACQUIRE))
+        return 1;
+
+    // A run of length r takes at most r bytes, and only the first run of
+    // a plane can be empty.
+    size_t size = 0;
+    for (int b = f->start; b < f->stop; ++b)
+        size += (size_t)f->width[b] * f->height[b] + 1;
+
+    MaskRecord *record = malloc(sizeof(MaskRecord) + size);
+    if (!record)
+        return 0;
+
+    uint8_t *dstp = record->data;
+
+    for (int b = f->start; b < f->stop; ++b) {
+        const uint8_t *srcp = active.data[b];
+        uint8_t value = 0;
+        uint32_t run = 0;
+
+        for (int y = 0; y < f->height[b]; ++y) {
+            for (int x = 0; x < f->width[b]; ++x) {
+                const uint8_t v = srcp[x] ? 0xFF : 0;
+                if (v != value) {
+                    dstp = putRun(dstp, run);
+                    value = v;
+                    run = 0;
+                }
+                run++;
+            }
+            srcp += active.stride[b];
+        }
+
+        dstp = putRun(dstp, run);
+    }
+
+    record->hash = hash;
+    record->flags = flags;
+    record->size = (uint32_t)(dstp - record->data);
+
+    MaskRecord *shrunk = realloc(record, sizeof(MaskRecord) + record->size);
+    if (shrunk)
+        record = shrunk;
+
+    // When a field was computed twice, the first copy wins.
+    MaskRecord *expected = NULL;
+    if (__atomic_compare_exchange_n(&writer->records[n], &expected, record, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        __atomic_fetch_add(&writer->count, 1, __ATOMIC_RELAXED);
+    else
+        free(record);
+
+    return 1;
+}
+
+
+int tcombMaskWriterCount(const TCombMaskWriter *writer)
+{
+    return __atomic_load_n(&writer->count, __ATOMIC_RELAXED);
+}
+
+
+const char *tcombMaskWriterSave(const TCombMaskWriter *writer, const char *path)
+{
+    if (tcombMaskWriterCount(writer) != writer->num_fields)
+        return "TComb: Not every field was processed, so the mask file was not written.";
+
+    FILE *file = fopen(path, "wb");
+    if (!file)
+        return "TComb: Failed to open the mask file for writing.";
+
+    MaskFileHeader header;
+    headerFill(&header, &writer->filter, writer->num_fields);
+
+    int ok = fwrite(&header, sizeof(header), 1, file) == 1;
+
+    uint64_t offset = sizeof(MaskFileHeader) + (uint64_t)writer->num_fields * sizeof(MaskFileIndex);
+
+    for (int n = 0; n < writer->num_fields && ok; n++) {
+        const MaskRecord *record = writer->records[n];
+        MaskFileIndex index;
+
+        index.offset = offset;
+        index.hash = record->hash;
+        index.size = record->size;
+        index.flags = record->flags;
+
+        ok = fwrite(&index, sizeof(index), 1, file) == 1;
+
+        offset += record->size;
+    }
+
+    for (int n = 0; n < writer->num_fields && ok; n++) {
+        const MaskRecord *record = writer->records[n];
+
+        ok = fwrite(record->data, 1, record->size, file) == record->size;
+    }
+
+    if (fclose(file))
+        ok = 0;
+
+    if (!ok)
+        return "TComb: Failed to write the mask file.";
+
+    return NULL;
+}
+
+
+void tcombMaskWriterFree(TCombMaskWriter *writer)
+{
+    if (!writer)
+        return;
+
+    for (int n = 0; n < writer->num_fields; n++)
+        free(writer->records[n]);
+
+    free(writer->records);
+    free(writer);
+}
+
+
+struct TCombMaskReader {
+    TCombFilter filter;
+    int num_fields;
+
+    const uint8_t *data;
+    size_t size;
+    const MaskFileIndex *index;
+
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#endif
+};
+
+
+static int mapFile(TCombMaskReader *reader, const char *path)
+{
+#ifdef _WIN32
+    reader->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (reader->file == INVALID_HANDLE_VALUE)
+        return 0;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(reader->file, &size) || size.QuadPart == 0) {
+        CloseHandle(reader->file);
+        return 0;
+    }
+    reader->size = (size_t)size.QuadPart;
+
+    reader->mapping = CreateFileMappingA(reader->file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!reader->mapping) {
+        CloseHandle(reader->file);
+        return 0;
+    }
+
+    reader->data = MapViewOfFile(reader->mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!reader->data) {
+        CloseHandle(reader->mapping);
+        CloseHandle(reader->file);
+        return 0;
+    }
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return 0;
+
+    struct stat st;
+    if (fstat(fd, &st) || st.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+    reader->size = (size_t)st.st_size;
+
+    void *data = mmap(NULL, reader->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return 0;
+
+    reader->data = data;
+#endif
+
+    return 1;
+}
+
+
+static void unmapFile(TCombMaskReader *reader)
+{
+#ifdef _WIN32
+    UnmapViewOfFile(reader->data);
+    CloseHandle(reader->mapping);
+    CloseHandle(reader->file);
+#else
+    munmap((void *)reader->data, reader->size);
+#endif
+}
+
+
+TCombMaskReader *tcombMaskReaderOpen(const char *path, const TCombFilter *filter, int num_fields, char *error, size_t error_size)
+{
+    TCombMaskReader *reader = calloc(1, sizeof(TCombMaskReader));
+    if (!reader) {
+        snprintf(error, error_size, "TComb: Out of memory.");
+        return NULL;
+    }
+
+    reader->filter = *filter;
+    reader->num_fields = num_fields;
+
+    if (!mapFile(reader, path)) {
+        snprintf(error, error_size, "TComb: Failed to open the mask file '%s'.", path);
+        free(reader);
+        return NULL;
+    }
+
+    MaskFileHeader expected;
+    headerFill(&expected, filter, num_fields);
+
+    MaskFileHeader header;
+    if (reader->size < sizeof(header)) {
+        snprintf(error, error_size, "TComb: '%s' is not a mask file.", path);
+        goto fail;
+    }
+    memcpy(&header, reader->data, sizeof(header));
+
+    if (memcmp(header.magic, expected.magic, sizeof(header.magic)) ||
+        header.version != expected.version ||
+        header.header_size != expected.header_size) {
+        snprintf(error, error_size, "TComb: '%s' is not a mask file, or it was written by a different version of TComb.", path);
+        goto fail;
+    }
+
+    if (header.num_fields != expected.num_fields ||
+        header.num_planes != expected.num_planes ||
+        memcmp(header.width, expected.width, sizeof(header.width)) ||
+        memcmp(header.height, expected.height, sizeof(header.height))) {
+        snprintf(error, error_size, "TComb: The mask file '%s' was made from a clip with a different length, format, or dimensions.", path);
+        goto fail;
+    }
+
+    if (header.mode != expected.mode ||
+        header.fthreshl != expected.fthreshl ||
+        header.fthreshc != expected.fthreshc ||
+        header.othreshl != expected.othreshl ||
+        header.othreshc != expected.othreshc ||
+        header.preset != expected.preset ||
+        header.left != expected.left ||
+        header.top != expected.top ||
+        header.active_width != expected.active_width ||
+        header.active_height != expected.active_height ||
+        header.scthresh != expected.scthresh) {
+        snprintf(error, error_size, "TComb: The mask file '%s' was made with different parameters.", path);
+        goto fail;
+    }
+
+    const size_t index_end = sizeof(MaskFileHeader) + (size_t)num_fields * sizeof(MaskFileIndex);
+    if (reader->size < index_end) {
+        snprintf(error, error_size, "TComb: The mask file '%s' is truncated.", path);
+        goto fail;
+    }
+
+    reader->index = (const MaskFileIndex *)(reader->data + sizeof(MaskFileHeader));
+
+    for (int n = 0; n < num_fields; n++) {
+        if (reader->index[n].offset < index_end ||
+            reader->index[n].offset > reader->size ||
+            reader->index[n].size > reader->size - reader->index[n].offset) {
+            snprintf(error, error_size, "TComb: The mask file '%s' is truncated.", path);
+            goto fail;
+        }
+    }
+
+    return reader;
+
+fail:
+    unmapFile(reader);
+    free(reader);
+    return NULL;
+}
+
+
+int tcombMaskReaderFlags(const TCombMaskReader *reader, int n)
+{
+    return reader->index[n].flags;
+}
+
+
+uint64_t tcombMaskReaderHash(const TCombMaskReader *reader, int n)
+{
+    return reader->index[n].hash;
+}
+
+
+int tcombMaskReaderDecode(const TCombMaskReader *reader, int n, TCombFrame *msk2)
+{
+    const TCombFilter *f = &reader->filter;
+    const TCombFrame active = tcombActiveView(f, msk2);
+    const uint8_t *srcp = reader->data + reader->index[n].offset;
+    const uint8_t *end = srcp + reader->index[n].size;
+
+    for (int b = f->start; b < f->stop; ++b) {
+        const int width = f->width[b];
+        const int height = f->height[b];
+        uint8_t *dstp = active.data[b];
+        uint8_t value = 0;
+        int x = 0, y = 0;
+
+        while (y < height) {
+            uint32_t run = 0;
+            int shift = 0;
+
+            do {
+                if (srcp == end || shift > 28)
+                    return 0;
+                run |= (uint32_t)(*srcp & 0x7F) << shift;
+                shift += 7;
+            } while (*srcp++ & 0x80);
+
+            while (run) {
+                if (y == height)
+                    return 0;
+
+                const int length = (int)(run < (uint32_t)(width - x) ? run : (uint32_t)(width - x));
+                memset(dstp + x, value, length);
+                x += length;
+                run -= length;
+
+                if (x == width) {
+                    x = 0;
+                    y++;
+                    dstp += active.stride[b];
+                }
+            }
+
+            value = ~value;
+        }
+    }
+
+    return srcp == end;
+}
+
+
+void tcombMaskReaderClose(TCombMaskReader *reader)
+{
+    if (!reader)
+        return;
+
+    unmapFile(reader);
+    free(reader);
+}
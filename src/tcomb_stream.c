@@ -0,0 +1,564 @@
+/*
+ **   Streaming interface to the TComb core.
+ **
+ **   Copyright (C) 2005-2006 Kevin Stone
+ **
+ **   VapourSynth port by dubhater
+ **
+ **   This program is free software; you can redistribute it and/or modify
+ **   it under the terms of the GNU General Public License as published by
+ **   the Free Software Foundation; either version 2 of the License, or
+ **   (at your option) any later version.
+ **
+ **   This program is distributed in the hope that it will be useful,
+ **   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ **   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ **   GNU General Public License for more details.
+ **
+ **   You should have received a copy of the GNU General Public License
+ **   along with this program; if not, write to the Free Software
+ **   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tcomb_core.h"
+
+
+// Every pushed field runs one step. Step t runs each stage on field
+// t - lag, where the lags are chosen so that everything a stage reads was
+// finished in an earlier step. The stages of one step are independent.
+enum StageLags {
+    Stage1Lag = 0,
+    Stage2Lag = 1,      // reads stage 1 at n - 2 and n
+    Stage3Lag = 10,     // reads stage 2 at n ... n + 8
+    Stage4Lag = 17,     // reads stage 3 at n - 4 ... n + 6
+    Stage5Lag = 22,     // reads stage 4 at n ... n + 4
+    NumStages = 5
+};
+
+// A buffer written by a stage with lag w and read by a stage with lag r at
+// offsets down to n - o must survive r - w + o steps.
+enum BufferSlots {
+    BlurredSlots = Stage2Lag - Stage1Lag + 2 + 1,
+    ScSlots = Stage4Lag - Stage1Lag + 2 + 1,
+    Msk1Slots = Stage4Lag - Stage2Lag + 2 + 1,
+    AvgSlots = Stage3Lag - Stage2Lag + 1,
+    OmskSlots = Stage4Lag - Stage3Lag + 2 + 1,
+    Msk2Slots = Stage5Lag - Stage4Lag + 1,
+    DupSlots = Stage5Lag - Stage1Lag + 2 + 1,
+    PairSlots = 8       // Stage 4 of n and n + 1 read the pairs from n - 2 to n + 5
+};
+
+
+typedef struct Buffer {
+    void *memory;
+    TCombFrame frame;
+} Buffer;
+
+
+struct TCombStream {
+    TCombFilter filter;
+
+    TCombParallelFor parallel_for;
+    void *executor_data;
+
+    TCombField fields[TCOMB_STREAM_DEPTH];
+
+    int pushed;
+    int pulled;
+    int steps;
+    int total;      // -1 until tcombStreamFinish
+
+    // A field identical to n - 2 shares its blurs, so each field
+    // refers to one of the two buffers of its parity.
+    Buffer blurred[BlurredSlots][6];
+    int blurred_buffer[BlurredSlots];
+    int sc[ScSlots];
+    int dup[DupSlots];
+    Buffer msk1[Msk1Slots];
+    Buffer avg[AvgSlots];
+    Buffer omsk[OmskSlots];
+    Buffer msk2[Msk2Slots];
+
+    // Stage 4's pairs of omsk, keyed by the first field of the pair.
+    Buffer pairs[PairSlots];
+    int pair_field[PairSlots];
+
+    Buffer blur_tmp;
+    Buffer scratch[4];      // lowmem: Stage 2's blurs
+    Buffer tmp;
+    Buffer min;
+    Buffer max;
+    Buffer pad;
+};
+
+
+// Allocates planes [start, stop), each enlarged by padding pixels in both
+// directions, with a spare row after each plane for the SIMD kernels'
+// overreads.
+static int bufferAlloc(Buffer *buffer, const TCombFilter *f, int start, int stop, int padding)
+{
+    size_t offsets[3] = { 0 };
+    size_t size = 0;
+
+    memset(buffer, 0, sizeof(*buffer));
+
+    for (int b = start; b < stop; ++b) {
+        buffer->frame.stride[b] = (f->fieldWidth[b] + padding + 31) & ~31;
+        offsets[b] = size;
+        size += (size_t)buffer->frame.stride[b] * (f->fieldHeight[b] + padding + 1);
+    }
+
+    buffer->memory = malloc(size + TCOMB_ALIGNMENT);
+    if (!buffer->memory)
+        return 0;
+
+    uint8_t *base = (uint8_t *)(((uintptr_t)buffer->memory + TCOMB_ALIGNMENT - 1) & ~(uintptr_t)(TCOMB_ALIGNMENT - 1));
+
+    for (int b = start; b < stop; ++b)
+        buffer->frame.data[b] = base + offsets[b];
+
+    return 1;
+}
+
+
+static void bufferFree(Buffer *buffer)
+{
+    free(buffer->memory);
+    buffer->memory = NULL;
+}
+
+
+static int clampField(const TCombStream *s, int n)
+{
+    if (n < 0)
+        return 0;
+    if (s->total >= 0 && n > s->total - 1)
+        return s->total - 1;
+    return n;
+}
+
+
+static TCombFrame fieldView(const TCombStream *s, int n)
+{
+    const TCombField *field = &s->fields[clampField(s, n) % TCOMB_STREAM_DEPTH];
+    TCombFrame view = { { NULL }, { 0 } };
+
+    for (int b = 0; b < s->filter.numPlanes; ++b) {
+        view.data[b] = (uint8_t *)field->src[b];
+        view.stride[b] = field->srcStride[b];
+    }
+
+    return view;
+}
+
+
+static void runStage1(TCombStream *s, int n)
+{
+    const TCombFrame prev = fieldView(s, n - 2);
+    const TCombFrame cur = fieldView(s, n);
+    TCombFrame blurred[6];
+
+    const int dup = tcombFieldsEqual(&s->filter, &prev, &cur);
+    s->dup[n % DupSlots] = dup;
+
+    if (s->filter.params.lowmem) {
+        s->sc[n % ScSlots] = tcombStage1(&s->filter, &prev, &cur, NULL, NULL);
+        return;
+    }
+
+    // Below 2, n - 2 is clamped to a field of the other parity.
+    if (n >= 2 && dup) {
+        s->blurred_buffer[n % BlurredSlots] = s->blurred_buffer[(n - 2) % BlurredSlots];
+        s->sc[n % ScSlots] = tcombStage1(&s->filter, &prev, &cur, NULL, NULL);
+        return;
+    }
+
+    const int buffer = n >= 2 ? s->blurred_buffer[(n - 2) % BlurredSlots] ^ 2 : n % BlurredSlots;
+    s->blurred_buffer[n % BlurredSlots] = buffer;
+
+    for (int i = 0; i < tcombBlurCount(&s->filter); i++)
+        blurred[i] = s->blurred[buffer][i].frame;
+
+    s->sc[n % ScSlots] = tcombStage1(&s->filter, &prev, &cur, blurred, &s->blur_tmp.frame);
+}
+
+
+static void runStage2(TCombStream *s, int n)
+{
+    const TCombFrame prev = fieldView(s, n - 2);
+    const TCombFrame cur = fieldView(s, n);
+    TCombFrame prev_blurred[6], cur_blurred[6];
+
+    const int lowmem = s->filter.params.lowmem;
+
+    if (s->dup[n % DupSlots]) {
+        tcombStage2Duplicate(&s->filter, &cur, &s->msk1[n % Msk1Slots].frame, lowmem ? NULL : &s->avg[n % AvgSlots].frame);
+        return;
+    }
+
+    if (lowmem) {
+        TCombFrame scratch[4];
+        for (int i = 0; i < 4; i++)
+            scratch[i] = s->scratch[i].frame;
+
+        tcombStage2LowMem(&s->filter, &prev, &cur, &s->msk1[n % Msk1Slots].frame, scratch);
+        return;
+    }
+
+    const int prev_buffer = s->blurred_buffer[clampField(s, n - 2) % BlurredSlots];
+    const int cur_buffer = s->blurred_buffer[n % BlurredSlots];
+
+    for (int i = 0; i < tcombBlurCount(&s->filter); i++) {
+        prev_blurred[i] = s->blurred[prev_buffer][i].frame;
+        cur_blurred[i] = s->blurred[cur_buffer][i].frame;
+    }
+
+    tcombStage2(&s->filter, &prev, &cur, prev_blurred, cur_blurred,
+            &s->msk1[n % Msk1Slots].frame, &s->avg[n % AvgSlots].frame);
+}
+
+
+static void runStage3(TCombStream *s, int n)
+{
+    TCombFrame src[5];
+    TCombFrame avg[4];
+
+    for (int i = 0; i < 5; i++)
+        src[i] = fieldView(s, n + 8 - i * 2);
+
+    if (s->filter.params.lowmem) {
+        TCombFrame avg_prev[4];
+
+        for (int i = 0; i < 4; i++) {
+            const int k = clampField(s, n + 6 - i * 2);
+            avg[i] = fieldView(s, k);
+            avg_prev[i] = fieldView(s, k - 2);
+        }
+
+        tcombStage3LowMem(&s->filter, src, avg, avg_prev, &s->omsk[n % OmskSlots].frame);
+        return;
+    }
+
+    for (int i = 0; i < 4; i++)
+        avg[i] = s->avg[clampField(s, n + 6 - i * 2) % AvgSlots].frame;
+
+    tcombStage3(&s->filter, src, avg, &s->omsk[n % OmskSlots].frame);
+}
+
+
+static void runStage4(TCombStream *s, int n)
+{
+    const TCombFrame prev2 = fieldView(s, n - 4);
+    const TCombFrame cur = fieldView(s, n);
+    int sc[2];
+    TCombFrame omsk[5];
+    TCombFrame msk1[2];
+
+    for (int i = 0; i < 5; i++)
+        omsk[i] = s->omsk[clampField(s, n - 2 + i * 2) % OmskSlots].frame;
+
+    for (int i = 0; i < 2; i++) {
+        sc[i] = s->sc[clampField(s, n - 2 + i * 2) % ScSlots];
+        msk1[i] = s->msk1[clampField(s, n - 2 + i * 2) % Msk1Slots].frame;
+    }
+
+    // Only the pair of n + 4 and n + 6 is new, unless a scene change
+    // made the previous fields skip them.
+    TCombFrame pairs[4];
+    const int use_pairs = tcombFilterProcessesLuma(&s->filter) && !sc[0] && !sc[1];
+
+    for (int i = 0; i < 4 && use_pairs; i++) {
+        const int k = n - 2 + i * 2;
+        const int slot = (k + 2) % PairSlots;
+
+        if (s->pair_field[slot] != k) {
+            tcombStage4Pair(&s->filter, &omsk[i], &omsk[i + 1], &s->pairs[slot].frame);
+            s->pair_field[slot] = k;
+        }
+
+        pairs[i] = s->pairs[slot].frame;
+    }
+
+    tcombStage4(&s->filter, &prev2, &cur, sc, omsk, use_pairs ? pairs : NULL, msk1, &s->tmp.frame, &s->msk2[n % Msk2Slots].frame);
+}
+
+
+static void runStage5(TCombStream *s, int n)
+{
+    const TCombField *field = &s->fields[n % TCOMB_STREAM_DEPTH];
+    TCombFrame src[5];
+    TCombFrame msk2[3];
+    TCombFrame dst = { { NULL }, { 0 } };
+
+    if (!field->dst[0])
+        return;
+
+    for (int i = 0; i < 5; i++)
+        src[i] = fieldView(s, n - 4 + i * 2);
+
+    for (int i = 0; i < 3; i++)
+        msk2[i] = s->msk2[clampField(s, n + i * 2) % Msk2Slots].frame;
+
+    for (int b = 0; b < s->filter.numPlanes; ++b) {
+        dst.data[b] = field->dst[b];
+        dst.stride[b] = field->dstStride[b];
+    }
+
+    // If all five fields are identical, every filtered value is equal to
+    // the original one and the output is field n.
+    int identical = !s->filter.params.map;
+
+    for (int i = 1; i < 5 && identical; i++) {
+        const int k = clampField(s, n - 4 + i * 2);
+        const int prev_k = clampField(s, n - 6 + i * 2);
+
+        identical = k == prev_k || (clampField(s, k - 2) == prev_k && s->dup[k % DupSlots]);
+    }
+
+    if (identical) {
+        for (int b = 0; b < s->filter.numPlanes; ++b)
+            for (int y = 0; y < s->filter.fieldHeight[b]; ++y)
+                memcpy(dst.data[b] + y * dst.stride[b], src[2].data[b] + y * src[2].stride[b], s->filter.fieldWidth[b]);
+        return;
+    }
+
+    tcombStage5(&s->filter, src, msk2, &dst, NULL, &s->min.frame, &s->max.frame, &s->pad.frame);
+    tcombStage5Unprocessed(&s->filter, &src[2], &dst);
+}
+
+
+typedef struct StepTasks {
+    TCombStream *stream;
+    int count;
+    int stage[NumStages];
+    int field[NumStages];
+} StepTasks;
+
+
+static void runStepTask(void *task_data, int index)
+{
+    StepTasks *tasks = (StepTasks *)task_data;
+    TCombStream *s = tasks->stream;
+    const int n = tasks->field[index];
+
+    switch (tasks->stage[index]) {
+    case 0: runStage1(s, n); break;
+    case 1: runStage2(s, n); break;
+    case 2: runStage3(s, n); break;
+    case 3: runStage4(s, n); break;
+    case 4: runStage5(s, n); break;
+    }
+}
+
+
+static void runStep(TCombStream *s)
+{
+    static const int lags[NumStages] = { Stage1Lag, Stage2Lag, Stage3Lag, Stage4Lag, Stage5Lag };
+    const int available = s->total >= 0 ? s->total : s->pushed;
+
+    StepTasks tasks;
+    tasks.stream = s;
+    tasks.count = 0;
+
+    for (int i = 0; i < NumStages; i++) {
+        const int n = s->steps - lags[i];
+        if (n >= 0 && n < available) {
+            tasks.stage[tasks.count] = i;
+            tasks.field[tasks.count] = n;
+            tasks.count++;
+        }
+    }
+
+    if (s->parallel_for && tasks.count > 1) {
+        s->parallel_for(s->executor_data, tasks.count, runStepTask, &tasks);
+    } else {
+        for (int i = 0; i < tasks.count; i++)
+            runStepTask(&tasks, i);
+    }
+
+    s->steps++;
+}
+
+
+TCombStream *tcombStreamCreate(const TCombParams *params, const TCombFormat *format, char *error, size_t error_size)
+{
+    TCombStream *s = calloc(1, sizeof(TCombStream));
+    if (!s) {
+        snprintf(error, error_size, "TComb: Out of memory.");
+        return NULL;
+    }
+
+    const char *message = tcombFilterInit(&s->filter, params, format);
+    if (message) {
+        snprintf(error, error_size, "%s", message);
+        free(s);
+        return NULL;
+    }
+
+    s->total = -1;
+
+    const TCombFilter *f = &s->filter;
+    int ok = 1;
+
+    const int lowmem = f->params.lowmem;
+
+    if (tcombFilterProcessesLuma(f)) {
+        for (int i = 0; i < BlurredSlots && !lowmem; i++)
+            for (int j = 0; j < tcombBlurCount(f); j++)
+                ok = ok && bufferAlloc(&s->blurred[i][j], f, 0, 1, 0);
+
+        if (f->params.preset == PresetFast && !lowmem)
+            ok = ok && bufferAlloc(&s->blur_tmp, f, 0, 1, 0);
+
+        for (int i = 0; i < 4 && lowmem; i++)
+            ok = ok && bufferAlloc(&s->scratch[i], f, 0, 1, 0);
+
+        for (int i = 0; i < Msk1Slots; i++)
+            ok = ok && bufferAlloc(&s->msk1[i], f, 0, 1, 0);
+
+        for (int i = 0; i < PairSlots; i++) {
+            ok = ok && bufferAlloc(&s->pairs[i], f, 0, 1, 0);
+            s->pair_field[i] = -PairSlots;
+        }
+    }
+
+    for (int i = 0; i < AvgSlots && !lowmem; i++)
+        ok = ok && bufferAlloc(&s->avg[i], f, f->start, f->stop, 0);
+
+    for (int i = 0; i < OmskSlots; i++)
+        ok = ok && bufferAlloc(&s->omsk[i], f, f->start, f->stop, 0);
+
+    for (int i = 0; i < Msk2Slots; i++)
+        ok = ok && bufferAlloc(&s->msk2[i], f, f->start, f->stop, 0);
+
+    ok = ok && bufferAlloc(&s->tmp, f, f->start, f->stop, 0);
+    ok = ok && bufferAlloc(&s->min, f, f->start, f->stop, 0);
+    ok = ok && bufferAlloc(&s->max, f, f->start, f->stop, 0);
+    ok = ok && bufferAlloc(&s->pad, f, f->start, f->stop, 4);
+
+    if (!ok) {
+        snprintf(error, error_size, "TComb: Out of memory.");
+        tcombStreamFree(s);
+        return NULL;
+    }
+
+    return s;
+}
+
+
+void tcombStreamSetExecutor(TCombStream *stream, TCombParallelFor parallel_for, void *executor_data)
+{
+    stream->parallel_for = parallel_for;
+    stream->executor_data = executor_data;
+}
+
+
+int tcombStreamPushField(TCombStream *stream, const TCombField *field)
+{
+    TCombStream *s = stream;
+
+    if (s->total >= 0)
+        return TCombStreamFinished;
+
+    if (s->pushed - s->pulled >= TCOMB_STREAM_DEPTH)
+        return TCombStreamFull;
+
+    for (int b = 0; b < s->filter.numPlanes; ++b) {
+        if (!field->src[b] ||
+            ((uintptr_t)field->src[b] % TCOMB_ALIGNMENT) ||
+            (field->srcStride[b] % TCOMB_ALIGNMENT) ||
+            field->srcStride[b] < s->filter.fieldWidth[b])
+            return TCombStreamBadField;
+
+        if (field->dst[0] && (!field->dst[b] || field->dstStride[b] < s->filter.fieldWidth[b]))
+            return TCombStreamBadField;
+
+        if (s->pushed > 0 && field->srcStride[b] != s->fields[0].srcStride[b])
+            return TCombStreamBadField;
+    }
+
+    s->fields[s->pushed % TCOMB_STREAM_DEPTH] = *field;
+    s->pushed++;
+
+    runStep(s);
+
+    return TCombStreamOk;
+}
+
+
+int tcombStreamFinish(TCombStream *stream)
+{
+    TCombStream *s = stream;
+
+    if (s->total >= 0)
+        return TCombStreamFinished;
+
+    s->total = s->pushed;
+
+    while (s->steps < s->total + Stage5Lag)
+        runStep(s);
+
+    return TCombStreamOk;
+}
+
+
+int tcombStreamPullField(TCombStream *stream, void **user_data)
+{
+    TCombStream *s = stream;
+
+    if (s->pulled >= s->pushed)
+        return 0;
+
+    // The last step that reads field n's source is the one that runs
+    // stage 5 on field n + 4.
+    if (s->total < 0 && s->steps <= s->pulled + TCOMB_STREAM_DELAY)
+        return 0;
+
+    *user_data = s->fields[s->pulled % TCOMB_STREAM_DEPTH].userData;
+    s->pulled++;
+
+    return 1;
+}
+
+
+void tcombStreamFree(TCombStream *stream)
+{
+    TCombStream *s = stream;
+
+    if (!s)
+        return;
+
+    for (int i = 0; i < BlurredSlots; i++)
+        for (int j = 0; j < 6; j++)
+            bufferFree(&s->blurred[i][j]);
+
+    for (int i = 0; i < Msk1Slots; i++)
+        bufferFree(&s->msk1[i]);
+
+    for (int i = 0; i < PairSlots; i++)
+        bufferFree(&s->pairs[i]);
+
+    for (int i = 0; i < AvgSlots; i++)
+        bufferFree(&s->avg[i]);
+
+    for (int i = 0; i < OmskSlots; i++)
+        bufferFree(&s->omsk[i]);
+
+    for (int i = 0; i < Msk2Slots; i++)
+        bufferFree(&s->msk2[i]);
+
+    bufferFree(&s->blur_tmp);
+    for (int i = 0; i < 4; i++)
+        bufferFree(&s->scratch[i]);
+    bufferFree(&s->tmp);
+    bufferFree(&s->min);
+    bufferFree(&s->max);
+    bufferFree(&s->pad);
+
+    free(s);
+}
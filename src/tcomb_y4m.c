@@ -0,0 +1,660 @@
+/*
+ **   tcomb-y4m: runs TComb on a YUV4MPEG2 stream, from stdin to stdout.
+ **
+ **   Copyright (C) 2005-2006 Kevin Stone
+ **
+ **   VapourSynth port by dubhater
+ **
+ **   This program is free software; you can redistribute it and/or modify
+ **   it under the terms of the GNU General Public License as published by
+ **   the Free Software Foundation; either version 2 of the License, or
+ **   (at your option) any later version.
+ **
+ **   This program is distributed in the hope that it will be useful,
+ **   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ **   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ **   GNU General Public License for more details.
+ **
+ **   You should have received a copy of the GNU General Public License
+ **   along with this program; if not, write to the Free Software
+ **   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+#include "tcomb_core.h"
+
+
+// Enough frames to cover everything the stream holds on to, plus some
+// slack for the reader and the writer to run ahead and behind.
+#define NUM_FRAMES (TCOMB_STREAM_DELAY / 2 + 8)
+
+#define MAX_HEADER 1024
+
+
+typedef struct Frame {
+    void *memory;
+    uint8_t *src[3];
+    uint8_t *dst[3];
+    int stride[3];
+    int fields_done;
+    int wanted; // written out, rather than only read for context
+    int last;   // end of stream marker, carries no picture
+} Frame;
+
+
+typedef struct Queue {
+    Frame *items[NUM_FRAMES + 1];
+    int head, count;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} Queue;
+
+
+static void queueInit(Queue *q)
+{
+    q->head = q->count = 0;
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->cond, NULL);
+}
+
+
+static void queuePush(Queue *q, Frame *frame)
+{
+    pthread_mutex_lock(&q->lock);
+    q->items[(q->head + q->count) % (NUM_FRAMES + 1)] = frame;
+    q->count++;
+    pthread_cond_signal(&q->cond);
+    pthread_mutex_unlock(&q->lock);
+}
+
+
+static Frame *queuePop(Queue *q)
+{
+    pthread_mutex_lock(&q->lock);
+    while (!q->count)
+        pthread_cond_wait(&q->cond, &q->lock);
+    Frame *frame = q->items[q->head];
+    q->head = (q->head + 1) % (NUM_FRAMES + 1);
+    q->count--;
+    pthread_mutex_unlock(&q->lock);
+    return frame;
+}
+
+
+// A fork-join pool that runs the independent stages of one stream step.
+typedef struct Pool {
+    pthread_t *threads;
+    int num_threads;
+
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t done;
+
+    void (*task)(void *task_data, int index);
+    void *task_data;
+    int count;
+    int next;
+    int remaining;
+    unsigned generation;
+    int quit;
+} Pool;
+
+
+static void poolRunTasks(Pool *pool)
+{
+    while (pool->next < pool->count) {
+        const int index = pool->next++;
+
+        pthread_mutex_unlock(&pool->lock);
+        pool->task(pool->task_data, index);
+        pthread_mutex_lock(&pool->lock);
+
+        if (--pool->remaining == 0)
+            pthread_cond_broadcast(&pool->done);
+    }
+}
+
+
+static void *poolWorker(void *arg)
+{
+    Pool *pool = (Pool *)arg;
+    unsigned seen = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (!pool->quit && pool->generation == seen)
+            pthread_cond_wait(&pool->work, &pool->lock);
+        if (pool->quit)
+            break;
+        seen = pool->generation;
+        poolRunTasks(pool);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+
+static void poolParallelFor(void *executor_data, int count, void (*task)(void *task_data, int index), void *task_data)
+{
+    Pool *pool = (Pool *)executor_data;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->task = task;
+    pool->task_data = task_data;
+    pool->count = count;
+    pool->next = 0;
+    pool->remaining = count;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->work);
+
+    poolRunTasks(pool);
+    while (pool->remaining)
+        pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+
+static int poolInit(Pool *pool, int num_threads)
+{
+    memset(pool, 0, sizeof(*pool));
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    pool->threads = calloc(num_threads, sizeof(pthread_t));
+    if (!pool->threads)
+        return 0;
+
+    for (int i = 0; i < num_threads; i++) {
+        if (pthread_create(&pool->threads[i], NULL, poolWorker, pool))
+            break;
+        pool->num_threads++;
+    }
+
+    return 1;
+}
+
+
+static void poolFree(Pool *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->quit = 1;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->num_threads; i++)
+        pthread_join(pool->threads[i], NULL);
+
+    free(pool->threads);
+}
+
+
+typedef struct Context {
+    FILE *in;
+    FILE *out;
+
+    int width[3];
+    int height[3];
+    int num_planes;
+
+    Frame frames[NUM_FRAMES];
+    Frame end;
+
+    Queue free_frames;
+    Queue read_frames;
+    Queue done_frames;
+
+    // The frames that get written, counted from the start of the input.
+    // Only the ones the range depends on are processed as well, and the
+    // input isn't read past them.
+    int first_frame;
+    int last_frame;     // -1 means until the end
+
+    int read_error;
+    int write_error;
+    int process_error;
+} Context;
+
+
+static int readLine(FILE *in, char *line, int size)
+{
+    int length = 0;
+
+    for (;;) {
+        const int c = fgetc(in);
+        if (c == EOF)
+            return length ? -1 : 0;
+        if (c == '\n')
+            break;
+        if (length == size - 1)
+            return -1;
+        line[length++] = (char)c;
+    }
+
+    line[length] = 0;
+    return 1;
+}
+
+
+static void *readerThread(void *arg)
+{
+    Context *ctx = (Context *)arg;
+    char line[MAX_HEADER];
+
+    // Frames that no field of the range depends on are skipped, in whole
+    // frames so that the stream starts with a top field.
+    const int context_before = (TCOMB_STREAM_HALO_BEFORE + 1) / 2;
+    const int context_after = (TCOMB_STREAM_HALO_AFTER + 1) / 2;
+
+    for (int n = 0; ctx->last_frame < 0 || n <= ctx->last_frame + context_after; n++) {
+        const int ret = readLine(ctx->in, line, sizeof(line));
+        if (ret <= 0 || strncmp(line, "FRAME", 5)) {
+            if (ret != 0) {
+                fprintf(stderr, "tcomb-y4m: Malformed frame header.\n");
+                ctx->read_error = 1;
+            }
+            break;
+        }
+
+        Frame *frame = queuePop(&ctx->free_frames);
+
+        int ok = 1;
+        for (int b = 0; b < ctx->num_planes && ok; b++)
+            for (int y = 0; y < ctx->height[b] && ok; y++)
+                ok = fread(frame->src[b] + y * frame->stride[b], 1, ctx->width[b], ctx->in) == (size_t)ctx->width[b];
+
+        if (!ok) {
+            fprintf(stderr, "tcomb-y4m: Truncated frame.\n");
+            ctx->read_error = 1;
+            queuePush(&ctx->free_frames, frame);
+            break;
+        }
+
+        if (n < ctx->first_frame - context_before) {
+            queuePush(&ctx->free_frames, frame);
+            continue;
+        }
+
+        frame->fields_done = 0;
+        frame->wanted = n >= ctx->first_frame && (ctx->last_frame < 0 || n <= ctx->last_frame);
+        queuePush(&ctx->read_frames, frame);
+    }
+
+    queuePush(&ctx->read_frames, &ctx->end);
+
+    return NULL;
+}
+
+
+static void *writerThread(void *arg)
+{
+    Context *ctx = (Context *)arg;
+
+    for (;;) {
+        Frame *frame = queuePop(&ctx->done_frames);
+        if (frame->last)
+            break;
+
+        if (frame->wanted && !ctx->write_error && !ctx->process_error) {
+            int ok = fputs("FRAME\n", ctx->out) >= 0;
+            for (int b = 0; b < ctx->num_planes && ok; b++)
+                for (int y = 0; y < ctx->height[b] && ok; y++)
+                    ok = fwrite(frame->dst[b] + y * frame->stride[b], 1, ctx->width[b], ctx->out) == (size_t)ctx->width[b];
+
+            if (!ok) {
+                fprintf(stderr, "tcomb-y4m: Failed to write output.\n");
+                ctx->write_error = 1;
+            }
+        }
+
+        queuePush(&ctx->free_frames, frame);
+    }
+
+    fflush(ctx->out);
+
+    return NULL;
+}
+
+
+static void pullFields(TCombStream *stream, Context *ctx)
+{
+    void *user_data;
+
+    while (tcombStreamPullField(stream, &user_data)) {
+        Frame *frame = (Frame *)user_data;
+        if (++frame->fields_done == 2)
+            queuePush(&ctx->done_frames, frame);
+    }
+}
+
+
+static void pushFrame(TCombStream *stream, Context *ctx, Frame *frame)
+{
+    // Top field first, like std.SeparateFields(tff=True) in the plugin.
+    for (int parity = 0; parity < 2; parity++) {
+        TCombField field;
+        memset(&field, 0, sizeof(field));
+
+        for (int b = 0; b < ctx->num_planes; b++) {
+            field.src[b] = frame->src[b] + frame->stride[b] * parity;
+            field.srcStride[b] = frame->stride[b] * 2;
+            if (frame->wanted) {
+                field.dst[b] = frame->dst[b] + frame->stride[b] * parity;
+                field.dstStride[b] = frame->stride[b] * 2;
+            }
+        }
+        field.userData = frame;
+
+        const int ret = tcombStreamPushField(stream, &field);
+        if (ret != TCombStreamOk) {
+            fprintf(stderr, "tcomb-y4m: Failed to push a field (error %d).\n", ret);
+            ctx->process_error = 1;
+
+            // Count the fields that never made it into the stream as done,
+            // so that the frame is recycled once the others come back out.
+            frame->fields_done += 2 - parity;
+            if (frame->fields_done == 2)
+                queuePush(&ctx->done_frames, frame);
+            return;
+        }
+
+        pullFields(stream, ctx);
+    }
+}
+
+
+static int parseColorspace(const char *tag, TCombFormat *format)
+{
+    static const struct {
+        const char *name;
+        int numPlanes;
+        int subSamplingW;
+        int subSamplingH;
+    } colorspaces[] = {
+        { "420jpeg", 3, 1, 1 },
+        { "420paldv", 3, 1, 1 },
+        { "420mpeg2", 3, 1, 1 },
+        { "420", 3, 1, 1 },
+        { "422", 3, 1, 0 },
+        { "444", 3, 0, 0 },
+        { "411", 3, 2, 0 },
+        { "440", 3, 0, 1 },
+        { "mono", 1, 0, 0 },
+    };
+
+    for (size_t i = 0; i < sizeof(colorspaces) / sizeof(colorspaces[0]); i++) {
+        if (!strcmp(tag, colorspaces[i].name)) {
+            format->numPlanes = colorspaces[i].numPlanes;
+            format->subSamplingW = colorspaces[i].subSamplingW;
+            format->subSamplingH = colorspaces[i].subSamplingH;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+static void usage(void)
+{
+    fprintf(stderr,
+            "Usage: tcomb-y4m [options] < input.y4m > output.y4m\n"
+            "\n"
+            "Runs TComb on interlaced, top field first, 8 bit YUV4MPEG2 input.\n"
+            "\n"
+            "Options (defaults in brackets):\n"
+            "  --mode N        0 luma only, 1 chroma only, 2 both [2]\n"
+            "  --fthreshl N    filtered pixel correlation threshold, luma [4]\n"
+            "  --fthreshc N    filtered pixel correlation threshold, chroma [5]\n"
+            "  --othreshl N    original pixel correlation threshold, luma [5]\n"
+            "  --othreshc N    original pixel correlation threshold, chroma [6]\n"
+            "  --map[=0|1]     show which pixels get filtered instead of filtering\n"
+            "  --scthresh F    scene change threshold in percent, negative disables [12.0]\n"
+            "  --preset N      0 full blur pyramid, 1 fast, with two blurs [0]\n"
+            "  --left N        columns at the left edge to copy through unprocessed [0]\n"
+            "  --top N         rows at the top edge to copy through unprocessed [0]\n"
+            "  --right N       columns at the right edge to copy through unprocessed [0]\n"
+            "  --bottom N      rows at the bottom edge to copy through unprocessed [0]\n"
+            "  --lowmem N      1 recomputes the blurs and averages instead of keeping them [0]\n"
+            "  --first N       first frame to write, the 3 before only serve as context [0]\n"
+            "  --last N        last frame to write, the 9 after only serve as context [end]\n"
+            "  --threads N     worker threads for the filter stages [4]\n");
+}
+
+
+int main(int argc, char **argv)
+{
+    TCombParams params;
+    tcombParamsDefault(&params);
+
+    int num_threads = 4;
+    int first_frame = 0, last_frame = -1;
+
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *value = NULL;
+
+        if (!strcmp(arg, "-h") || !strcmp(arg, "--help")) {
+            usage();
+            return 0;
+        }
+
+        if (!strcmp(arg, "--map")) {
+            params.map = 1;
+            continue;
+        }
+
+        const char *eq = strchr(arg, '=');
+        char name[32];
+        if (eq) {
+            snprintf(name, sizeof(name), "%.*s", (int)(eq - arg), arg);
+            value = eq + 1;
+        } else {
+            snprintf(name, sizeof(name), "%s", arg);
+            if (i + 1 < argc)
+                value = argv[++i];
+        }
+
+        if (!value) {
+            fprintf(stderr, "tcomb-y4m: Option '%s' needs a value.\n", name);
+            return 1;
+        }
+
+        if (!strcmp(name, "--mode"))
+            params.mode = atoi(value);
+        else if (!strcmp(name, "--fthreshl"))
+            params.fthreshl = atoi(value);
+        else if (!strcmp(name, "--fthreshc"))
+            params.fthreshc = atoi(value);
+        else if (!strcmp(name, "--othreshl"))
+            params.othreshl = atoi(value);
+        else if (!strcmp(name, "--othreshc"))
+            params.othreshc = atoi(value);
+        else if (!strcmp(name, "--map"))
+            params.map = !!atoi(value);
+        else if (!strcmp(name, "--scthresh"))
+            params.scthresh = atof(value);
+        else if (!strcmp(name, "--preset"))
+            params.preset = atoi(value);
+        else if (!strcmp(name, "--left"))
+            params.left = atoi(value);
+        else if (!strcmp(name, "--top"))
+            params.top = atoi(value);
+        else if (!strcmp(name, "--right"))
+            params.right = atoi(value);
+        else if (!strcmp(name, "--bottom"))
+            params.bottom = atoi(value);
+        else if (!strcmp(name, "--lowmem"))
+            params.lowmem = !!atoi(value);
+        else if (!strcmp(name, "--first"))
+            first_frame = atoi(value);
+        else if (!strcmp(name, "--last"))
+            last_frame = atoi(value);
+        else if (!strcmp(name, "--threads"))
+            num_threads = atoi(value);
+        else {
+            fprintf(stderr, "tcomb-y4m: Unknown option '%s'.\n", name);
+            usage();
+            return 1;
+        }
+    }
+
+    if (num_threads < 1) {
+        fprintf(stderr, "tcomb-y4m: --threads must be at least 1.\n");
+        return 1;
+    }
+
+    if (first_frame < 0 || (last_frame >= 0 && last_frame < first_frame)) {
+        fprintf(stderr, "tcomb-y4m: --first must not be negative or after --last.\n");
+        return 1;
+    }
+
+    // The options count the rows of frames, the filter those of fields.
+    if (params.top > 0)
+        params.top /= 2;
+    if (params.bottom > 0)
+        params.bottom /= 2;
+
+#ifdef _WIN32
+    _setmode(_fileno(stdin), _O_BINARY);
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+
+    static Context context;
+    Context *ctx = &context;
+    ctx->in = stdin;
+    ctx->out = stdout;
+    ctx->first_frame = first_frame;
+    ctx->last_frame = last_frame;
+
+    char header[MAX_HEADER];
+    if (readLine(ctx->in, header, sizeof(header)) <= 0 || strncmp(header, "YUV4MPEG2 ", 10)) {
+        fprintf(stderr, "tcomb-y4m: Input is not a YUV4MPEG2 stream.\n");
+        return 1;
+    }
+
+    int width = 0, height = 0;
+    TCombFormat format = { 0, 0, 3, 1, 1 };
+
+    char tags[MAX_HEADER];
+    snprintf(tags, sizeof(tags), "%s", header + 10);
+    for (char *tag = strtok(tags, " "); tag; tag = strtok(NULL, " ")) {
+        if (tag[0] == 'W') {
+            width = atoi(tag + 1);
+        } else if (tag[0] == 'H') {
+            height = atoi(tag + 1);
+        } else if (tag[0] == 'C' && !parseColorspace(tag + 1, &format)) {
+            fprintf(stderr, "tcomb-y4m: Unsupported colorspace '%s', input must be 8 bit Gray or YUV.\n", tag + 1);
+            return 1;
+        }
+    }
+
+    if (width <= 0 || height <= 0 || height % (2 << format.subSamplingH) ||
+        width % (1 << format.subSamplingW)) {
+        fprintf(stderr, "tcomb-y4m: Unsupported dimensions %dx%d.\n", width, height);
+        return 1;
+    }
+
+    format.width = width;
+    format.height = height / 2;
+
+    char error[256];
+    TCombStream *stream = tcombStreamCreate(&params, &format, error, sizeof(error));
+    if (!stream) {
+        fprintf(stderr, "tcomb-y4m: %s\n", error);
+        return 1;
+    }
+
+    Pool pool;
+    if (num_threads > 1) {
+        if (!poolInit(&pool, num_threads - 1)) {
+            fprintf(stderr, "tcomb-y4m: Failed to start the worker threads.\n");
+            return 1;
+        }
+        tcombStreamSetExecutor(stream, poolParallelFor, &pool);
+    }
+
+    ctx->num_planes = format.numPlanes;
+    for (int b = 0; b < ctx->num_planes; b++) {
+        ctx->width[b] = b ? width >> format.subSamplingW : width;
+        ctx->height[b] = b ? height >> format.subSamplingH : height;
+    }
+
+    queueInit(&ctx->free_frames);
+    queueInit(&ctx->read_frames);
+    queueInit(&ctx->done_frames);
+
+    for (int i = 0; i < NUM_FRAMES; i++) {
+        Frame *frame = &ctx->frames[i];
+        size_t size = 0;
+
+        for (int b = 0; b < ctx->num_planes; b++) {
+            frame->stride[b] = (ctx->width[b] + 31) & ~31;
+            size += (size_t)frame->stride[b] * (ctx->height[b] + 1);
+        }
+
+        frame->memory = malloc(size * 2 + TCOMB_ALIGNMENT);
+        if (!frame->memory) {
+            fprintf(stderr, "tcomb-y4m: Out of memory.\n");
+            return 1;
+        }
+
+        uint8_t *p = (uint8_t *)(((uintptr_t)frame->memory + TCOMB_ALIGNMENT - 1) & ~(uintptr_t)(TCOMB_ALIGNMENT - 1));
+        for (int b = 0; b < ctx->num_planes; b++) {
+            frame->src[b] = p;
+            p += (size_t)frame->stride[b] * (ctx->height[b] + 1);
+            frame->dst[b] = p;
+            p += (size_t)frame->stride[b] * (ctx->height[b] + 1);
+        }
+
+        queuePush(&ctx->free_frames, frame);
+    }
+    ctx->end.last = 1;
+
+    if (fprintf(ctx->out, "%s\n", header) < 0) {
+        fprintf(stderr, "tcomb-y4m: Failed to write output.\n");
+        return 1;
+    }
+
+    pthread_t reader, writer;
+    pthread_create(&reader, NULL, readerThread, ctx);
+    pthread_create(&writer, NULL, writerThread, ctx);
+
+    for (;;) {
+        Frame *frame = queuePop(&ctx->read_frames);
+        if (frame->last)
+            break;
+
+        if (ctx->process_error)
+            queuePush(&ctx->free_frames, frame);
+        else
+            pushFrame(stream, ctx, frame);
+    }
+
+    tcombStreamFinish(stream);
+    pullFields(stream, ctx);
+    queuePush(&ctx->done_frames, &ctx->end);
+
+    pthread_join(reader, NULL);
+    pthread_join(writer, NULL);
+
+    if (num_threads > 1)
+        poolFree(&pool);
+    tcombStreamFree(stream);
+
+    for (int i = 0; i < NUM_FRAMES; i++)
+        free(ctx->frames[i].memory);
+
+    return ctx->read_error || ctx->write_error || ctx->process_error;
+}